@@ -32,7 +32,12 @@
 #include <query/Query.h>
 #include <query/Expression.h>
 #include <system/Config.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_set>
 
+#include "Collectives.h"
 #include "EquiJoinSettings.h"
 #include "JoinHashTable.h"
 
@@ -41,47 +46,54 @@ namespace scidb
 namespace equi_join
 {
 
+/**
+ * A bit vector made of whole 64-byte blocks, each aligned to a cache line.
+ */
 class BitVector
 {
+public:
+    static size_t const BLOCK_BITS  = 512;
+    static size_t const BLOCK_WORDS = BLOCK_BITS / 64;
+
 private:
     size_t _size;
-    vector<char> _data;
+    vector<uint64_t> _data;   //BLOCK_WORDS - 1 words longer than needed, so the blocks can start on a line
+    size_t _offset;           //the index of the first block-aligned word of _data
+
+    void align()
+    {
+        _offset = ((BLOCK_BITS / 8 - reinterpret_cast<uintptr_t>(&(_data[0])) % (BLOCK_BITS / 8)) % (BLOCK_BITS / 8)) / sizeof(uint64_t);
+    }
 
 public:
+    /**
+     * bitSize is rounded up to a whole number of blocks, at least one.
+     */
     BitVector (size_t const bitSize):
-        _size(bitSize),
-        _data( (_size+7) / 8, 0)
-    {}
-
-    BitVector(size_t const bitSize, void const* data):
-        _size(bitSize),
-        _data( (_size+7) / 8, 0)
+        _size( std::max<size_t>((bitSize + BLOCK_BITS - 1) / BLOCK_BITS, 1) * BLOCK_BITS ),
+        _data( _size / 64 + BLOCK_WORDS - 1, 0)
     {
-        memcpy(&(_data[0]), data, _data.size());
+        align();
     }
 
-    void set(size_t const& idx)
+    BitVector(size_t const bitSize, void const* data):
+        BitVector(bitSize)
     {
-        if(idx >= _size)
-        {
-            throw 0;
-        }
-        size_t byteIdx = idx / 8;
-        size_t bitIdx  = idx - byteIdx * 8;
-        char& b = _data[ byteIdx ];
-        b = b | (1 << bitIdx);
+        memcpy(getWords(), data, getByteSize());
     }
 
-    bool get(size_t const& idx) const
+    BitVector(BitVector const& other):
+        BitVector(other._size, other.getData())
+    {}
+
+    BitVector(BitVector&& other) = default;
+
+    BitVector& operator=(BitVector other)
     {
-        if(idx >= _size)
-        {
-            throw 0;
-        }
-        size_t byteIdx = idx / 8;
-        size_t bitIdx  = idx - byteIdx * 8;
-        char const& b = _data[ byteIdx ];
-        return (b & (1 << bitIdx));
+        _size = other._size;
+        _data.swap(other._data);
+        _offset = other._offset;
+        return *this;
     }
 
     size_t getBitSize() const
@@ -89,14 +101,29 @@ public:
         return _size;
     }
 
+    size_t getNumBlocks() const
+    {
+        return _size / BLOCK_BITS;
+    }
+
     size_t getByteSize() const
     {
-        return _data.size();
+        return _size / 8;
     }
 
     char const* getData() const
     {
-        return &(_data[0]);
+        return reinterpret_cast<char const*>(getWords());
+    }
+
+    uint64_t* getWords()
+    {
+        return &(_data[_offset]);
+    }
+
+    uint64_t const* getWords() const
+    {
+        return &(_data[_offset]);
     }
 
     void orIn(BitVector const& other)
@@ -105,128 +132,183 @@ public:
         {
             throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "OR-ing in unequal vit vectors";
         }
-        for(size_t i =0; i<_data.size(); ++i)
+        uint64_t* words = getWords();
+        uint64_t const* otherWords = other.getWords();
+        for(size_t i =0; i<_size / 64; ++i)
         {
-            _data[i] |= other._data[i];
+            words[i] |= otherWords[i];
         }
     }
 };
 
+/**
+ * The instance that ArrayWriter<WRITE_SPLIT_ON_HASH> sends a tuple with this hash to: the uint64 range is split into
+ * numInstances equal intervals, in order.
+ */
+inline size_t getInstanceForHash(uint64_t const hash, size_t const numInstances)
+{
+    if(hash == 0)
+    {
+        return 0;
+    }
+    size_t const instance = (hash - 1) / (std::numeric_limits<uint64_t>::max() / numInstances);
+    return instance < numInstances - 1 ? instance : numInstances - 1;
+}
+
+/**
+ * A cache-line blocked Bloom filter. One 64-bit hash of the keys picks a 512-bit block, and numHashes bits of that
+ * block are derived from the same hash, so adding or looking up a key costs one cache miss. The hash is either given,
+ * such as the tuple hash that places tuples on instances, or murmur of the data. Filters are only combined with others
+ * of the same size, number of hashes and partitions; all instances must agree on all three.
+ */
 class BloomFilter
 {
 public:
-    static uint32_t const hashSeed1 = 0x5C1DB123;
-    static uint32_t const hashSeed2 = 0xACEDBEEF;
+    static uint32_t const hashSeed = 0xACEDBEEF;  //not the seed of the tuple hash, which places tuples on instances
+    static size_t const DEFAULT_HASHES = 3;       //when the number of keys is not known
+    static size_t const MAX_HASHES = 16;
+
+    /**
+     * The number of hashes that minimizes false positives for expectedKeys keys in bitSize bits: bits per key times
+     * ln 2, rounded, between 1 and MAX_HASHES; DEFAULT_HASHES if expectedKeys is 0.
+     */
+    static size_t chooseNumHashes(size_t const bitSize, size_t const expectedKeys)
+    {
+        if(expectedKeys == 0)
+        {
+            return DEFAULT_HASHES;
+        }
+        double const best = 0.6931471805599453 * bitSize / expectedKeys + 0.5;
+        return best < 1 ? 1 : best >= MAX_HASHES ? MAX_HASHES : (size_t) best;
+    }
+
+    /**
+     * The number of bits that holds expectedKeys keys at a false positive rate of fpr, when the number of hashes is
+     * chosen to match: -expectedKeys * ln(fpr) / (ln 2)^2, at most maxBits; maxBits if expectedKeys is 0.
+     */
+    static size_t chooseBitSize(size_t const expectedKeys, double const fpr, size_t const maxBits)
+    {
+        if(expectedKeys == 0)
+        {
+            return maxBits;
+        }
+        double const best = std::ceil(- std::log(fpr) / (0.6931471805599453 * 0.6931471805599453) * expectedKeys);
+        return best >= maxBits ? maxBits : (size_t) best;
+    }
 
 private:
     BitVector _vec;
-    mutable vector<char> _hashBuf;
+    size_t _numHashes;
+    size_t _numPartitions;
+    size_t _partitionBlocks;  //with more than one partition, the number of blocks in each
+
+    uint64_t getBlockIndex(uint64_t const hash) const
+    {
+        if(_numPartitions == 1)
+        {
+            return (hash >> 32) * _vec.getNumBlocks() >> 32;
+        }
+        return getInstanceForHash(hash, _numPartitions) * _partitionBlocks + ((hash & 0xFFFFFFFF) * _partitionBlocks >> 32);
+    }
+
+    /**
+     * The i-th bit of a hash within its block: the top 9 bits of hash times an odd constant to the power i+1.
+     */
+    static size_t nextBit(uint64_t& mix)
+    {
+        mix *= 0x9E3779B97F4A7C15ULL;
+        return mix >> 55;
+    }
 
 public:
-    BloomFilter(size_t const bitSize):
-        _vec(bitSize),
-        _hashBuf(64)
+    /**
+     * With numPartitions above 1, the filter is split into that many equal parts, and a hash only ever sets bits in
+     * the part of the instance that getInstanceForHash places it on; numPartitions is then the number of instances.
+     */
+    BloomFilter(size_t const bitSize, size_t const numHashes = DEFAULT_HASHES, size_t const numPartitions = 1):
+        _vec(std::max<size_t>((bitSize + numPartitions * BitVector::BLOCK_BITS - 1) / (numPartitions * BitVector::BLOCK_BITS), 1) *
+             numPartitions * BitVector::BLOCK_BITS),
+        _numHashes(numHashes),
+        _numPartitions(numPartitions),
+        _partitionBlocks(_vec.getNumBlocks() / numPartitions)
     {}
 
-    void addData(void const* data, size_t const dataSize )
+    /**
+     * A filter sized for expectedKeys keys at Settings::getBloomFilterFpr, up to Settings::getBloomFilterSize bits, with
+     * Settings::getBloomFilterHashes hashes if set, otherwise as many as suit that size. expectedKeys is 0 if not known,
+     * and must be the same on all instances.
+     */
+    BloomFilter(Settings const& settings, size_t const expectedKeys = 0, size_t const numPartitions = 1):
+        BloomFilter(chooseBitSize(expectedKeys, settings.getBloomFilterFpr(), settings.getBloomFilterSize()),
+                    settings.getBloomFilterHashes() > MAX_HASHES ? MAX_HASHES :
+                    settings.getBloomFilterHashes() != 0         ? settings.getBloomFilterHashes() :
+                    chooseNumHashes(chooseBitSize(expectedKeys, settings.getBloomFilterFpr(), settings.getBloomFilterSize()), expectedKeys),
+                    numPartitions)
+    {}
+
+    size_t getBitSize() const
     {
-        uint32_t hash1 = JoinHashTable::murmur3_32((char const*) data, dataSize, hashSeed1) % _vec.getBitSize();
-        uint32_t hash2 = JoinHashTable::murmur3_32((char const*) data, dataSize, hashSeed2) % _vec.getBitSize();
-        _vec.set(hash1);
-        _vec.set(hash2);
+        return _vec.getBitSize();
     }
 
-    bool hasData(void const* data, size_t const dataSize ) const
+    size_t getNumHashes() const
     {
-        uint32_t hash1 = JoinHashTable::murmur3_32((char const*) data, dataSize, hashSeed1) % _vec.getBitSize();
-        uint32_t hash2 = JoinHashTable::murmur3_32((char const*) data, dataSize, hashSeed2) % _vec.getBitSize();
-        return _vec.get(hash1) && _vec.get(hash2);
+        return _numHashes;
     }
 
-    void addTuple(vector<Value const*> data, size_t const numKeys)
+    void addHash(uint64_t const hash)
     {
-        size_t totalSize = 0;
-        for(size_t i=0; i<numKeys; ++i)
-        {
-            totalSize+=data[i]->size();
-        }
-        if(_hashBuf.size() < totalSize)
-        {
-            _hashBuf.resize(totalSize);
-        }
-        char* ch = &_hashBuf[0];
-        for(size_t i =0; i<numKeys; ++i)
+        uint64_t* block = _vec.getWords() + getBlockIndex(hash) * BitVector::BLOCK_WORDS;
+        uint64_t mix = hash;
+        for(size_t i =0; i<_numHashes; ++i)
         {
-            memcpy(ch, data[i]->data(), data[i]->size());
-            ch += data[i]->size();
+            size_t const bit = nextBit(mix);
+            block[bit / 64] |= (1ULL << (bit % 64));
         }
-        addData(&_hashBuf[0], totalSize);
     }
 
-    bool hasTuple(vector<Value const*> data, size_t const numKeys) const
+    bool hasHash(uint64_t const hash) const
     {
-        size_t totalSize = 0;
-        for(size_t i=0; i<numKeys; ++i)
+        uint64_t const* block = _vec.getWords() + getBlockIndex(hash) * BitVector::BLOCK_WORDS;
+        uint64_t mix = hash;
+        for(size_t i =0; i<_numHashes; ++i)
         {
-            totalSize+=data[i]->size();
-        }
-        if(_hashBuf.size() < totalSize)
-        {
-            _hashBuf.resize(totalSize);
+            size_t const bit = nextBit(mix);
+            if((block[bit / 64] & (1ULL << (bit % 64))) == 0)
+            {
+                return false;
+            }
         }
-        char* ch = &_hashBuf[0];
-        for(size_t i =0; i<numKeys; ++i)
+        return true;
+    }
+
+    void addData(void const* data, size_t const dataSize )
+    {
+        addHash(JoinHashTable<>::murmur3_64((char const*) data, dataSize, hashSeed));
+    }
+
+    bool hasData(void const* data, size_t const dataSize ) const
+    {
+        return hasHash(JoinHashTable<>::murmur3_64((char const*) data, dataSize, hashSeed));
+    }
+
+    void orIn(BloomFilter const& other)
+    {
+        if(other._numHashes != _numHashes || other._numPartitions != _numPartitions)
         {
-            memcpy(ch, data[i]->data(), data[i]->size());
-            ch += data[i]->size();
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "OR-ing in bloom filters with different hash counts";
         }
-        return hasData(&_hashBuf[0], totalSize);
+        _vec.orIn(other._vec);
     }
 
+    /**
+     * OR the filters of all instances together, with allReduce. The parts of a partitioned filter are the slices that
+     * allReduce splits it into, so when each instance only holds the hashes of its own part, the reduce step only sends
+     * empty slices, and each part travels once to every other instance.
+     */
     void globalExchange(shared_ptr<Query>& query)
     {
-        /*
-         * The bloom filters are sufficiently large (4MB each?), so we use two-phase messaging to save memory in case
-         * there are a lot of instances (i.e. 256). This means two rounds of messaging, a little longer to execute but
-         * we won't see a sudden memory spike (only on one instance, not on every instance).
-         */
-        size_t const nInstances = query->getInstancesCount();
-        InstanceID myId = query->getInstanceID();
-        if(!query->isCoordinator())
-        {
-           InstanceID coordinator = query->getCoordinatorID();
-           shared_ptr<SharedBuffer> buf(new MemoryBuffer(NULL, _vec.getByteSize()));
-           memcpy(buf->getWriteData(), _vec.getData(), _vec.getByteSize());
-           BufSend(coordinator, buf, query);
-           buf = BufReceive(coordinator,query);
-           BitVector incoming(_vec.getBitSize(), buf->getWriteData());
-           _vec = incoming;
-        }
-        else
-        {
-           for(InstanceID i=0; i<nInstances; ++i)
-           {
-              if(i != myId)
-              {
-                  shared_ptr<SharedBuffer> inBuf = BufReceive(i,query);
-                  if(inBuf->getSize() != _vec.getByteSize())
-                  {
-                      throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "exchanging unequal bit vectors";
-                  }
-                  BitVector incoming(_vec.getBitSize(), inBuf->getWriteData());
-                  _vec.orIn(incoming);
-              }
-           }
-           shared_ptr<SharedBuffer> buf(new MemoryBuffer(NULL, _vec.getByteSize()));
-           memcpy(buf->getWriteData(), _vec.getData(), _vec.getByteSize());
-           for(InstanceID i=0; i<nInstances; ++i)
-           {
-              if(i != myId)
-              {
-                  BufSend(i, buf, query);
-              }
-           }
-        }
+        allReduce(_vec.getWords(), _vec.getBitSize() / 64, std::bit_or<uint64_t>(), query);
     }
 };
 
@@ -246,9 +328,53 @@ private:
     BloomFilter        _chunkHits;
     mutable vector<Coordinate> _coordBuf;
     mutable vector<Coordinate> _oldBuf;
+    vector<size_t>     _zoneTrainingFields;     //index into the training array tuple
+    vector<size_t>     _zoneFilterAttributes;   //integer key attributes of the filtered array
+    vector<int64_t>    _zoneMin;                //range of the training keys; min > max when none were seen
+    vector<int64_t>    _zoneMax;
+
+    struct ZoneMin
+    {
+        int64_t operator()(int64_t const a, int64_t const b) const
+        {
+            return a < b ? a : b;
+        }
+    };
+
+    struct ZoneMax
+    {
+        int64_t operator()(int64_t const a, int64_t const b) const
+        {
+            return a > b ? a : b;
+        }
+    };
 
 public:
-    ChunkFilter(Settings const& settings, ArrayDesc const& leftSchema, ArrayDesc const& rightSchema):
+    /**
+     * True for the key types whose ranges are kept: the signed integers and datetime, all compared as int64.
+     */
+    static bool isZoneType(TypeId const& type)
+    {
+        return type == TID_INT64 || type == TID_INT32 || type == TID_INT16 || type == TID_INT8 || type == TID_DATETIME;
+    }
+
+    static int64_t zoneValue(Value const& value)
+    {
+        switch(value.size())
+        {
+        case 1:  return value.getInt8();
+        case 2:  return value.getInt16();
+        case 4:  return value.getInt32();
+        default: return value.getInt64();
+        }
+    }
+
+
+    /**
+     * expectedCells is the number of tuples the filter is trained with, if known. The filter is sized for the smaller
+     * of that and the number of chunk positions along the joined dimensions of the filtered array, if those are bounded.
+     */
+    ChunkFilter(Settings const& settings, ArrayDesc const& leftSchema, ArrayDesc const& rightSchema, size_t const expectedCells = 0):
         _numJoinedDimensions(0),
         _chunkHits(0), //reallocated if actually needed below
         _coordBuf(0),
@@ -269,9 +395,35 @@ public:
                 _filterChunkSizes.push_back(dimension.getChunkInterval());
             }
         }
+        ArrayDesc const& filterSchema = WHICH == LEFT ? rightSchema : leftSchema;
+        for(size_t i=0; i<numFilterAtts; ++i)
+        {
+            if((WHICH == LEFT ? settings.isRightKey(i) : settings.isLeftKey(i)) &&
+               isZoneType(filterSchema.getAttributes(true).findattr(i).getType()))
+            {
+                _zoneTrainingFields.push_back( WHICH == LEFT ? settings.mapRightToTuple(i) : settings.mapLeftToTuple(i));
+                _zoneFilterAttributes.push_back(i);
+            }
+        }
+        _zoneMin.resize(_zoneFilterAttributes.size(), std::numeric_limits<int64_t>::max());
+        _zoneMax.resize(_zoneFilterAttributes.size(), std::numeric_limits<int64_t>::min());
         if(_numJoinedDimensions != 0)
         {
-            _chunkHits = BloomFilter(settings.getBloomFilterSize());
+            size_t expectedChunks = expectedCells;
+            size_t positions = 1;
+            for(size_t i=0; i<_numJoinedDimensions && positions != 0; ++i)
+            {
+                DimensionDesc const& dimension = WHICH == LEFT ? rightSchema.getDimensions()[_filterArrayDimensions[i]] :
+                                                                 leftSchema.getDimensions()[_filterArrayDimensions[i]];
+                size_t const chunks = dimension.getEndMax() >= CoordinateBounds::getMax() ? 0 :
+                                      (dimension.getEndMax() - dimension.getStartMin()) / dimension.getChunkInterval() + 1;
+                positions = chunks != 0 && positions <= std::numeric_limits<size_t>::max() / chunks ? positions * chunks : 0; //0: unbounded
+            }
+            if(positions != 0 && (expectedChunks == 0 || positions < expectedChunks))
+            {
+                expectedChunks = positions;
+            }
+            _chunkHits = BloomFilter(settings, expectedChunks);
             _coordBuf.resize(_numJoinedDimensions);
         }
         ostringstream message;
@@ -295,11 +447,26 @@ public:
         {
             message<<_filterChunkSizes[i]<<" ";
         }
+        message<<", zone attributes ";
+        for(size_t i=0; i<_zoneFilterAttributes.size(); ++i)
+        {
+            message<<_zoneFilterAttributes[i]<<" ";
+        }
         LOG4CXX_DEBUG(logger, message.str());
     }
 
     void addTuple(vector<Value const*> const& tuple)
     {
+        for(size_t i=0; i<_zoneTrainingFields.size(); ++i)
+        {
+            Value const& key = *(tuple[_zoneTrainingFields[i]]);
+            if(!key.isNull())
+            {
+                int64_t const v = zoneValue(key);
+                _zoneMin[i] = v < _zoneMin[i] ? v : _zoneMin[i];
+                _zoneMax[i] = v > _zoneMax[i] ? v : _zoneMax[i];
+            }
+        }
         if(_numJoinedDimensions==0)
         {
             return;
@@ -329,8 +496,58 @@ public:
         return result;
     }
 
+    /**
+     * @return the memory taken by the chunk bits and the zone maps, in bytes
+     */
+    size_t usedBytes() const
+    {
+        return _chunkHits.getBitSize() / 8 +
+               (_zoneTrainingFields.size() + _zoneFilterAttributes.size()) * sizeof(size_t) +
+               (_zoneMin.size() + _zoneMax.size()) * sizeof(int64_t);
+    }
+
+    /**
+     * Zone maps: the filtered array's integer key attributes, each with the range of values the training array has for
+     * that key. A chunk whose keys all fall outside the range of any one of them has no matches.
+     */
+    size_t getNumZones() const
+    {
+        return _zoneFilterAttributes.size();
+    }
+
+    size_t getZoneAttribute(size_t const zone) const
+    {
+        return _zoneFilterAttributes[zone];
+    }
+
+    bool overlapsZone(size_t const zone, int64_t const chunkMin, int64_t const chunkMax) const
+    {
+        return chunkMin <= _zoneMax[zone] && chunkMax >= _zoneMin[zone];
+    }
+
+    /**
+     * Add in the chunks seen by another filter over the same arrays, such as a copy trained on another thread.
+     */
+    void merge(ChunkFilter const& other)
+    {
+        for(size_t i=0; i<_zoneMin.size(); ++i)
+        {
+            _zoneMin[i] = ZoneMin()(_zoneMin[i], other._zoneMin[i]);
+            _zoneMax[i] = ZoneMax()(_zoneMax[i], other._zoneMax[i]);
+        }
+        if(_numJoinedDimensions!=0)
+        {
+            _chunkHits.orIn(other._chunkHits);
+        }
+    }
+
     void globalExchange(shared_ptr<Query>& query)
     {
+        if(!_zoneMin.empty())
+        {
+            allReduce(&(_zoneMin[0]), _zoneMin.size(), ZoneMin(), query);
+            allReduce(&(_zoneMax[0]), _zoneMax.size(), ZoneMax(), query);
+        }
         if(_numJoinedDimensions!=0)
         {
             _chunkHits.globalExchange(query);
@@ -338,26 +555,251 @@ public:
     }
 };
 
+/**
+ * Maps every distinct string key of both arrays to a dense int64 code, the same on all instances. The strings are
+ * collected locally with addArray, then merged on the coordinator and sent back to everyone by globalExchange.
+ * Codes follow the byte order of the strings, so tupled arrays holding codes sort and merge consistently on both
+ * sides. Once it is exchanged the dictionary is read-only and may be shared between threads.
+ *
+ * Every instance ends up holding all distinct strings, and each one crosses the network about once per instance,
+ * since the coordinator sends the merged dictionary to everyone. That only pays off when the keys repeat enough;
+ * globalExchange checks this before sending anything.
+ */
+class KeyDictionary
+{
+private:
+    std::unordered_set<string> _localStrings;
+    size_t                     _numKeyValues; //non-null key values read by addArray, and their bytes
+    size_t                     _keyBytes;
+    vector<string>             _strings;     //sorted and unique after globalExchange; the code of a string is its index
+    vector<Value>              _values;      //the same, as Values for decoding
+
+    struct StringLess
+    {
+        bool operator()(string const& s, Value const& v) const
+        {
+            int const res = memcmp(s.data(), v.data(), std::min(s.size(), v.size()));
+            return res < 0 || (res == 0 && s.size() < v.size());
+        }
+    };
+
+    static shared_ptr<SharedBuffer> serialize(vector<string> const& strings)
+    {
+        size_t totalSize = sizeof(size_t);
+        for(size_t i =0; i<strings.size(); ++i)
+        {
+            totalSize += sizeof(uint32_t) + strings[i].size();
+        }
+        shared_ptr<SharedBuffer> buf(new MemoryBuffer(NULL, totalSize));
+        char* ch = (char*) buf->getWriteData();
+        size_t const count = strings.size();
+        memcpy(ch, &count, sizeof(size_t));
+        ch += sizeof(size_t);
+        for(size_t i =0; i<count; ++i)
+        {
+            uint32_t const size = strings[i].size();
+            memcpy(ch, &size, sizeof(uint32_t));
+            ch += sizeof(uint32_t);
+            memcpy(ch, strings[i].data(), size);
+            ch += size;
+        }
+        return buf;
+    }
+
+    static void deserialize(shared_ptr<SharedBuffer> const& buf, vector<string>& strings)
+    {
+        char const* ch = (char const*) buf->getWriteData();
+        size_t count;
+        memcpy(&count, ch, sizeof(size_t));
+        ch += sizeof(size_t);
+        strings.reserve(strings.size() + count);
+        for(size_t i =0; i<count; ++i)
+        {
+            uint32_t size;
+            memcpy(&size, ch, sizeof(uint32_t));
+            ch += sizeof(uint32_t);
+            strings.push_back(string(ch, size));
+            ch += size;
+        }
+    }
+
+    static void sortUnique(vector<string>& strings)
+    {
+        std::sort(strings.begin(), strings.end());
+        strings.erase(std::unique(strings.begin(), strings.end()), strings.end());
+    }
+
+public:
+    KeyDictionary():
+        _numKeyValues(0),
+        _keyBytes(0)
+    {}
+
+    /**
+     * Collect the non-null values of the string keys that are attributes of input, WHICH side of the join.
+     */
+    template <Handedness WHICH>
+    void addArray(shared_ptr<Array> const& input, Settings const& settings)
+    {
+        size_t const numAttrs = (WHICH == LEFT ? settings.getNumLeftAttrs() : settings.getNumRightAttrs());
+        size_t i = 0;
+        for(const auto& attr : input->getArrayDesc().getAttributes(true))
+        {
+            if(i >= numAttrs)
+            {
+                break;
+            }
+            bool const isKey = (WHICH == LEFT ? settings.isLeftKey(i) : settings.isRightKey(i));
+            if(isKey && settings.isKeyString(WHICH == LEFT ? settings.mapLeftToTuple(i) : settings.mapRightToTuple(i)))
+            {
+                shared_ptr<ConstArrayIterator> aiter = input->getConstIterator(attr);
+                while(!aiter->end())
+                {
+                    shared_ptr<ConstChunkIterator> citer = aiter->getChunk().getConstIterator();
+                    while(!citer->end())
+                    {
+                        Value const& v = citer->getItem();
+                        if(!v.isNull())
+                        {
+                            _localStrings.insert(string((char const*) v.data(), v.size()));
+                            ++_numKeyValues;
+                            _keyBytes += v.size();
+                        }
+                        ++(*citer);
+                    }
+                    ++(*aiter);
+                }
+            }
+            ++i;
+        }
+    }
+
+    /**
+     * Gather the strings of all instances on the coordinator and send the merged dictionary back to everyone. The
+     * strings are not combined element-wise, so this does not use allReduce. First the instances agree whether the
+     * dictionary is worth it: the bytes it would send, at most the local distinct strings of every instance times the
+     * number of instances, must be less than the key bytes that codes save, and the strings must fit under the
+     * memory limit on every instance.
+     * @return false, on all instances, if the dictionary was dropped instead; it is then left empty
+     */
+    bool globalExchange(shared_ptr<Query>& query, Settings const& settings)
+    {
+        size_t const nInstances = query->getInstancesCount();
+        vector<size_t> totals(4, 0);
+        totals[0] = _localStrings.size();
+        for(std::unordered_set<string>::const_iterator iter = _localStrings.begin(); iter != _localStrings.end(); ++iter)
+        {
+            totals[1] += iter->size();
+        }
+        totals[2] = _numKeyValues;
+        totals[3] = _keyBytes;
+        globalSum(totals, query);
+        size_t const dictionaryBytes = totals[1] + totals[0] * (sizeof(string) + sizeof(Value));
+        size_t const savedBytes = totals[3] > totals[2] * sizeof(int64_t) ? totals[3] - totals[2] * sizeof(int64_t) : 0;
+        LOG4CXX_DEBUG(logger, "EJ key dictionary local strings "<<totals[0]<<" bytes "<<totals[1]<<" key values "<<totals[2]
+                      <<" bytes "<<totals[3]);
+        if(nInstances * totals[1] >= savedBytes || (settings.getMemoryLimit() && dictionaryBytes > settings.getMemoryLimit()))
+        {
+            LOG4CXX_DEBUG(logger, "EJ key dictionary not worth it, dropping it");
+            std::unordered_set<string>().swap(_localStrings);
+            return false;
+        }
+        _strings.assign(_localStrings.begin(), _localStrings.end());
+        std::unordered_set<string>().swap(_localStrings);
+        sortUnique(_strings);
+        InstanceID myId = query->getInstanceID();
+        if(!query->isCoordinator())
+        {
+            InstanceID coordinator = query->getCoordinatorID();
+            BufSend(coordinator, serialize(_strings), query);
+            shared_ptr<SharedBuffer> buf = BufReceive(coordinator, query);
+            _strings.clear();
+            deserialize(buf, _strings);
+        }
+        else
+        {
+            for(InstanceID i=0; i<nInstances; ++i)
+            {
+                if(i != myId)
+                {
+                    deserialize(BufReceive(i, query), _strings);
+                }
+            }
+            sortUnique(_strings);
+            shared_ptr<SharedBuffer> buf = serialize(_strings);
+            for(InstanceID i=0; i<nInstances; ++i)
+            {
+                if(i != myId)
+                {
+                    BufSend(i, buf, query);
+                }
+            }
+        }
+        _values.resize(_strings.size());
+        for(size_t i =0; i<_strings.size(); ++i)
+        {
+            _values[i].setData(_strings[i].data(), _strings[i].size());
+        }
+        LOG4CXX_DEBUG(logger, "EJ key dictionary exchanged, "<<_strings.size()<<" strings");
+        return true;
+    }
+
+    size_t size() const
+    {
+        return _strings.size();
+    }
+
+    /**
+     * Set code to the code of value, or to null if value is null.
+     */
+    void encode(Value const& value, Value& code) const
+    {
+        if(value.isNull())
+        {
+            code.setNull(value.getMissingReason());
+            return;
+        }
+        vector<string>::const_iterator iter = std::lower_bound(_strings.begin(), _strings.end(), value, StringLess());
+        if(iter == _strings.end() || iter->size() != value.size() || memcmp(iter->data(), value.data(), value.size()) != 0)
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "key missing from dictionary";
+        }
+        code.setInt64(iter - _strings.begin());
+    }
+
+    Value const& decode(Value const& code) const
+    {
+        return _values[code.getInt64()];
+    }
+};
+
 template <Handedness WHICH>
 ArrayDesc makeTupledSchema(Settings const& settings, shared_ptr< Query> const& query)
 {
     size_t const numAttrs = ( WHICH == LEFT ? settings.getLeftTupleSize() : settings.getRightTupleSize()) + 1; //plus hash
     Attributes outputAttributes(numAttrs);
     std::vector<AttributeDesc> tmpOutput(numAttrs);
-    tmpOutput[numAttrs-1] = AttributeDesc("hash", TID_UINT32, 0, CompressorType::NONE);
+    tmpOutput[numAttrs-1] = AttributeDesc("hash", TID_UINT64, 0, CompressorType::NONE);
     ArrayDesc const& inputSchema = ( WHICH == LEFT ? settings.getLeftSchema() : settings.getRightSchema());
     size_t const numInputAttrs = (WHICH == LEFT ? settings.getNumLeftAttrs() : settings.getNumRightAttrs());
     size_t const numInputDims = (WHICH == LEFT ? settings.getNumLeftDims() : settings.getNumRightDims());
     size_t i = 0;
     for(const auto& input : inputSchema.getAttributes(true))
     {
-        AttributeID destinationId = (WHICH == LEFT ? settings.mapLeftToTuple(i) : settings.mapRightToTuple(i));
+        ssize_t const mapped = (WHICH == LEFT ? settings.mapLeftToTuple(i) : settings.mapRightToTuple(i));
+        if(mapped < 0)
+        {
+            i++;
+            continue;
+        }
+        AttributeID destinationId = mapped;
         uint16_t flags = input.getFlags();
         if( (WHICH == LEFT ? settings.isLeftKey(i) : settings.isRightKey(i)) && settings.isKeyNullable(destinationId) )
         {
             flags |= AttributeDesc::IS_NULLABLE;
         }
-        tmpOutput[destinationId] = AttributeDesc(input.getName(), input.getType(), flags, CompressorType::NONE);
+        TypeId const type = destinationId < settings.getNumKeys() && settings.isKeyEncoded(destinationId) ? TID_INT64 : input.getType();
+        tmpOutput[destinationId] = AttributeDesc(input.getName(), type, flags, CompressorType::NONE);
         i++;
     }
     for(size_t i = 0; i< numInputDims; ++i )
@@ -386,6 +828,7 @@ enum WriteArrayType
 {
     WRITE_TUPLED,           //we're writing a tupled array (schema as above), we don't really use the dst_instance_id dimension
     WRITE_SPLIT_ON_HASH,    //we're writing a tupled array (schema as above), we expect input to be sorted on hash and we assign dst_instance_id chunks based on hash
+                            //the hash is the full 64-bit value, so the uint64 range is split evenly across instances
     WRITE_OUTPUT            //we're writing the output array (schema as generated in Settings). Here we merge left+right tuples and use the Filter Expression if any.
 };
 
@@ -406,7 +849,7 @@ private:
     Coordinates                         _outputPosition;
     vector<shared_ptr<ArrayIterator> >  _arrayIterators;
     vector<shared_ptr<ChunkIterator> >  _chunkIterators;
-    vector <uint32_t>                   _hashBreaks;
+    vector <uint64_t>                   _hashBreaks;
     int64_t                             _currentBreak;
     Value                               _boolTrue;
     Value                               _nullVal;
@@ -414,6 +857,9 @@ private:
     vector<BindInfo>                    _filterBindings;
     size_t                              _numBindings;
     shared_ptr<ExpressionContext>       _filterContext;
+    KeyDictionary const*                _keyDictionary;
+    bool const                          _writeMatches; //false for anti joins
+    bool const                          _writeMisses;  //false for semi joins
 
 public:
     ArrayWriter(Settings const& settings, shared_ptr<Query> const& query, ArrayDesc const& schema):
@@ -433,7 +879,10 @@ public:
         _chunkIterators   (_numAttributes+1, NULL),
         _hashBreaks       (_numInstances-1, 0),
         _currentBreak     (0),
-        _filterExpression (MODE == WRITE_OUTPUT ? settings.getFilterExpression() : NULL)
+        _filterExpression (MODE == WRITE_OUTPUT ? settings.getFilterExpression() : NULL),
+        _keyDictionary    (MODE == WRITE_OUTPUT ? settings.getKeyDictionary() : NULL),
+        _writeMatches     (!settings.isAntiJoin()),
+        _writeMisses      (!settings.isSemiJoin())
     {
         _boolTrue.setBool(true);
         _nullVal.setNull();
@@ -473,7 +922,7 @@ public:
             _outputPosition[2] = 0;
             if(MODE == WRITE_SPLIT_ON_HASH)
             {
-                uint32_t break_interval = settings.getNumHashBuckets() / _numInstances;
+                uint64_t break_interval = std::numeric_limits<uint64_t>::max() / _numInstances;
                 for(size_t i=0; i<_numInstances-1; ++i)
                 {
                     _hashBreaks[i] = break_interval * (i+1);
@@ -504,16 +953,13 @@ public:
         return true;
     }
 
-    void writeTuple(vector<Value const*> const& tuple)
+private:
+    void writeCell(vector<Value const*> const& tuple)
     {
-        if(MODE == WRITE_OUTPUT && !tuplePassesFilter(tuple))
-        {
-            return;
-        }
         bool newChunk = false;
         if(MODE == WRITE_SPLIT_ON_HASH)
         {
-            uint32_t hash = tuple[ _numAttributes-1 ]->getUint32();
+            uint64_t hash = tuple[ _numAttributes-1 ]->getUint64();
             while( static_cast<size_t>(_currentBreak) < _numInstances - 1 && hash > _hashBreaks[_currentBreak] )
             {
                 ++_currentBreak;
@@ -550,6 +996,30 @@ public:
         ++_outputPosition[ MODE == WRITE_OUTPUT ? 1 : 2];
     }
 
+    /**
+     * Put the strings back in place of the dictionary codes of the joined tuple in _tuplePlaceholder.
+     */
+    void decodeKeys()
+    {
+        for(size_t i=0; i<_numKeys; ++i)
+        {
+            if(_settings.isKeyEncoded(i) && !_tuplePlaceholder[i]->isNull())
+            {
+                _tuplePlaceholder[i] = &(_keyDictionary->decode(*(_tuplePlaceholder[i])));
+            }
+        }
+    }
+
+public:
+    void writeTuple(vector<Value const*> const& tuple)
+    {
+        if(MODE == WRITE_OUTPUT && !tuplePassesFilter(tuple))
+        {
+            return;
+        }
+        writeCell(tuple);
+    }
+
     void writeTupleWithHash(vector<Value const*> const& tuple, Value const& hash)
     {
         if(MODE != WRITE_TUPLED)
@@ -572,6 +1042,10 @@ public:
         {
             throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "internal inconsistency";
         }
+        if(!_writeMatches)
+        {
+            return;
+        }
         for(size_t i=0; i<_numAttributes; ++i)
         {
             if(i<_leftTupleSize)
@@ -583,6 +1057,10 @@ public:
                 _tuplePlaceholder[i] = &(getValueFromTuple(right, i - _leftTupleSize + _numKeys));
             }
         }
+        if(_keyDictionary)
+        {
+            decodeKeys();
+        }
         writeTuple(_tuplePlaceholder);
     }
 
@@ -593,6 +1071,10 @@ public:
         {
             throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "internal inconsistency";
         }
+        if(!_writeMisses)
+        {
+            return;
+        }
         for(size_t i=0; i<_numAttributes; ++i)
         {
             if(i<_numKeys)
@@ -622,9 +1104,56 @@ public:
                 }
             }
         }
+        if(_keyDictionary)
+        {
+            decodeKeys();
+        }
         writeTuple(_tuplePlaceholder);
     }
 
+    /**
+     * Append all cells of part, an array finalized by another ArrayWriter<WRITE_OUTPUT> with the same schema. The cells
+     * are renumbered to follow the ones already written; they have been filtered already.
+     */
+    void appendArray(shared_ptr<Array> const& part)
+    {
+        if(MODE != WRITE_OUTPUT)
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "internal inconsistency";
+        }
+        vector<shared_ptr<ConstArrayIterator> > aiters(_numAttributes);
+        vector<shared_ptr<ConstChunkIterator> > citers(_numAttributes);
+        size_t i = 0;
+        for(const auto& attr : part->getArrayDesc().getAttributes(true))
+        {
+            aiters[i] = part->getConstIterator(attr);
+            i++;
+        }
+        while(!aiters[0]->end())
+        {
+            for(i=0; i<_numAttributes; ++i)
+            {
+                citers[i] = aiters[i]->getChunk().getConstIterator();
+            }
+            while(!citers[0]->end())
+            {
+                for(i=0; i<_numAttributes; ++i)
+                {
+                    _tuplePlaceholder[i] = &(citers[i]->getItem());
+                }
+                writeCell(_tuplePlaceholder);
+                for(i=0; i<_numAttributes; ++i)
+                {
+                    ++(*citers[i]);
+                }
+            }
+            for(i=0; i<_numAttributes; ++i)
+            {
+                ++(*aiters[i]);
+            }
+        }
+    }
+
     shared_ptr<Array> finalize()
     {
         for(size_t i =0; i<_numAttributes+1; ++i)
@@ -657,44 +1186,52 @@ private:
     shared_ptr<Array>                       _input;
     Settings const&                         _settings;
     size_t const                            _nAttrs;   //internal: corresponds to num actual attributes
+    vector<size_t> const                    _readAttrs; //the attributes iterated over: with READ_INPUT, only those in the tuple
+    size_t const                            _nRead;
     size_t const                            _nDims;
     vector<Value const*>                    _tuple;    //external: corresponds to the left or right tuple desired
     vector<Value>                           _dimVals;  //for reading dimensions from INPUT
     size_t const                            _numKeys;
     Coordinate const                        _chunkSize;
     ChunkFilter<WHICH == LEFT ? RIGHT : LEFT> const *const   _readChunkFilter;
-    BloomFilter const * const               _readBloomFilter;
+    vector<size_t>                          _zoneReads; //index into _readAttrs of each zone of _readChunkFilter
     Coordinate                              _currChunkIdx;
+    size_t                                  _chunksLeft; //in the range given to the constructor
     vector<shared_ptr<ConstArrayIterator> > _aiters;
     vector<shared_ptr<ConstChunkIterator> > _citers;
     size_t                                  _chunksAvailable;
     size_t                                  _chunksExcluded;
     size_t                                  _tuplesAvailable;
     size_t                                  _tuplesExcludedNull;
-    size_t                                  _tuplesExcludedBloom;
 
 public:
+    /**
+     * @param firstChunk, numChunks restrict reading to a range of the chunks of input, in iteration order; lets
+     *        several threads split an array between them
+     */
     ArrayReader( shared_ptr<Array>& input, Settings const& settings,
                  ChunkFilter<WHICH == LEFT ? RIGHT : LEFT> const* readChunkFilter = NULL,
-                 BloomFilter const* readBloomFilter = NULL):
+                 size_t firstChunk = 0,
+                 size_t numChunks = static_cast<size_t>(-1)):
         _input(input),
         _settings(settings),
         _nAttrs( input->getArrayDesc().getAttributes(true).size()),
+        _readAttrs( chooseReadAttrs(_nAttrs, settings)),
+        _nRead( _readAttrs.size()),
         _nDims ( input->getArrayDesc().getDimensions().size()),
         _tuple( (WHICH == LEFT ? _settings.getLeftTupleSize() : _settings.getRightTupleSize()) + (MODE == READ_INPUT ? 0 : 1)),
         _dimVals (MODE == READ_INPUT ? _nDims : 0),
         _numKeys(_settings.getNumKeys()),
         _chunkSize( MODE == READ_SORTED ? _input->getArrayDesc().getDimensions()[0].getChunkInterval() : -1 ),
         _readChunkFilter(readChunkFilter),
-        _readBloomFilter(readBloomFilter),
         _currChunkIdx( MODE == READ_SORTED ? 0 : -1),
-        _aiters(_nAttrs),
-        _citers(_nAttrs),
+        _chunksLeft(numChunks),
+        _aiters(_nRead),
+        _citers(_nRead),
         _chunksAvailable(0),
         _chunksExcluded(0),
         _tuplesAvailable(0),
-        _tuplesExcludedNull(0),
-        _tuplesExcludedBloom(0)
+        _tuplesExcludedNull(0)
     {
         Dimensions const& dims = _input->getArrayDesc().getDimensions();
         if(MODE == READ_SORTED && (dims.size()!=1 || dims[0].getStartMin() != 0))
@@ -709,12 +1246,27 @@ public:
         {
             throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "Internal inconsistency";
         }
-        size_t i = 0;
+        size_t i = 0, j = 0;
         for(const auto& attr : _input->getArrayDesc().getAttributes(true))
         {
-            _aiters[i] = _input->getConstIterator(attr);
+            if(j < _nRead && _readAttrs[j] == i)
+            {
+                _aiters[j++] = _input->getConstIterator(attr);
+            }
             i++;
         }
+        for(size_t z =0; _readChunkFilter && z<_readChunkFilter->getNumZones(); ++z)
+        {
+            size_t const attr = _readChunkFilter->getZoneAttribute(z);
+            _zoneReads.push_back(std::lower_bound(_readAttrs.begin(), _readAttrs.end(), attr) - _readAttrs.begin());
+        }
+        for(size_t j =0; j<firstChunk && !_aiters[0]->end(); ++j)
+        {
+            for(size_t i =0; i<_nRead; ++i)
+            {
+                ++(*_aiters[i]);
+            }
+        }
         if(!end())
         {
             next<true>();
@@ -722,6 +1274,23 @@ public:
     }
 
 private:
+    static vector<size_t> chooseReadAttrs(size_t const nAttrs, Settings const& settings)
+    {
+        vector<size_t> result;
+        for(size_t i =0; i<nAttrs; ++i)
+        {
+            if(MODE != READ_INPUT || (WHICH == LEFT ? settings.mapLeftToTuple(i) : settings.mapRightToTuple(i)) >= 0)
+            {
+                result.push_back(i);
+            }
+        }
+        if(result.empty())
+        {
+            result.push_back(0); //the keys are all dimensions; cell positions still come from an attribute
+        }
+        return result;
+    }
+
     bool setAndCheckTuple()
     {
         ++_tuplesAvailable;
@@ -734,9 +1303,14 @@ private:
         }
         else
         {
-            for(size_t i =0; i<_nAttrs; ++i)
+            for(size_t i =0; i<_nRead; ++i)
             {
-                size_t idx = WHICH == LEFT ? _settings.mapLeftToTuple(i) : _settings.mapRightToTuple(i);
+                ssize_t const mapped = WHICH == LEFT ? _settings.mapLeftToTuple(_readAttrs[i]) : _settings.mapRightToTuple(_readAttrs[i]);
+                if(mapped < 0)
+                {
+                    continue;
+                }
+                size_t idx = mapped;
                 _tuple[idx] = &(_citers[i]->getItem());
                 if (INCLUDE_NULL_TUPLES == false && idx <_numKeys && _tuple[idx]->isNull())  //filter for NULLs
                 {
@@ -758,12 +1332,46 @@ private:
                 }
             }
         }
-        if(_readBloomFilter && _readBloomFilter->hasTuple(_tuple, _numKeys) == false) //now run through the bloom filter, if any
+        return true; //we got a valid tuple!
+    }
+
+    void nextChunk()
+    {
+        for(size_t i =0; i<_nRead; ++i)
         {
-            ++_tuplesExcludedBloom;
-            return false;
+            ++(*_aiters[i]);
         }
-        return true; //we got a valid tuple!
+        --_chunksLeft;
+    }
+
+    /**
+     * Check the range of each zone key in the current chunk against the filter. This reads one attribute chunk per zone
+     * key before the rest of the chunk is touched. A chunk whose keys are all NULL has nothing to join either.
+     */
+    bool chunkOverlapsZones()
+    {
+        for(size_t z =0; z<_zoneReads.size(); ++z)
+        {
+            int64_t chunkMin = std::numeric_limits<int64_t>::max();
+            int64_t chunkMax = std::numeric_limits<int64_t>::min();
+            shared_ptr<ConstChunkIterator> citer = _aiters[_zoneReads[z]]->getChunk().getConstIterator();
+            while(!citer->end())
+            {
+                Value const& key = citer->getItem();
+                if(!key.isNull())
+                {
+                    int64_t const v = ChunkFilter<WHICH == LEFT ? RIGHT : LEFT>::zoneValue(key);
+                    chunkMin = v < chunkMin ? v : chunkMin;
+                    chunkMax = v > chunkMax ? v : chunkMax;
+                }
+                ++(*citer);
+            }
+            if(chunkMin > chunkMax || !_readChunkFilter->overlapsZone(z, chunkMin, chunkMax))
+            {
+                return false;
+            }
+        }
+        return true;
     }
 
     bool findNextTupleInChunk()
@@ -774,7 +1382,7 @@ private:
             {
                 return true;
             }
-            for(size_t i =0; i<_nAttrs; ++i)
+            for(size_t i =0; i<_nRead; ++i)
             {
                 ++(*_citers[i]);
             }
@@ -792,7 +1400,7 @@ public:
         }
         if(!FIRST_ITERATION)
         {
-            for(size_t i =0; i<_nAttrs; ++i)
+            for(size_t i =0; i<_nRead; ++i)
             {
                 ++(*_citers[i]);
             }
@@ -800,28 +1408,22 @@ public:
             {
                 return;
             }
-            for(size_t i =0; i<_nAttrs; ++i)
-            {
-                ++(*_aiters[i]);
-            }
+            nextChunk();
         }
-        while(!_aiters[0]->end())
+        while(!end())
         {
             ++_chunksAvailable;
             if(MODE == READ_INPUT && _readChunkFilter)
             {
                 Coordinates const& chunkPos = _aiters[0]->getPosition();
-                if(! _readChunkFilter->containsChunk(chunkPos))
+                if(! _readChunkFilter->containsChunk(chunkPos) || ! chunkOverlapsZones())
                 {
-                    for(size_t i =0; i<_nAttrs; ++i)
-                    {
-                        ++(*_aiters[i]);
-                    }
+                    nextChunk();
                     ++_chunksExcluded;
                     continue;
                 }
             }
-            for(size_t i =0; i<_nAttrs; ++i)
+            for(size_t i =0; i<_nRead; ++i)
             {
                 _citers[i] = _aiters[i]->getChunk().getConstIterator();
             }
@@ -833,16 +1435,13 @@ public:
             {
                 return;
             }
-            for(size_t i =0; i<_nAttrs; ++i)
-            {
-                ++(*_aiters[i]);
-            }
+            nextChunk();
         }
     }
 
     bool end()
     {
-        return _aiters[0]->end();
+        return _chunksLeft == 0 || _aiters[0]->end();
     }
 
     void logStats()
@@ -850,7 +1449,7 @@ public:
         string const which = WHICH == LEFT ? "left" : "right";
         string const mode  = MODE == READ_INPUT ? "input" : MODE ==READ_TUPLED ? "tupled" : "sorted";
         LOG4CXX_DEBUG(logger, "EJ Array Read "<<which<<" "<< mode<< " total chunks "<<_chunksAvailable<<" chunks excluded "<<_chunksExcluded<<" tuples in included chunks "<<_tuplesAvailable<<
-                " NULL tuples excluded "<<_tuplesExcludedNull<<" Bloom filter tuples excluded "<<_tuplesExcludedBloom);
+                " NULL tuples excluded "<<_tuplesExcludedNull);
     }
 
     vector<Value const*> const& getTuple()
@@ -880,7 +1479,7 @@ public:
         Coordinates pos (1,idx);
         if(!end() && idx % _chunkSize == _currChunkIdx) //easy
         {
-            for(size_t i=0; i<_nAttrs; ++i)
+            for(size_t i=0; i<_nRead; ++i)
             {
                 if(!_citers[i]->setPosition(pos) || !setAndCheckTuple())
                 {
@@ -890,7 +1489,7 @@ public:
         }
         else
         {
-            for(size_t i=0; i<_nAttrs; ++i)
+            for(size_t i=0; i<_nRead; ++i)
             {
                 _citers[i].reset();
                 if(!_aiters[i]->setPosition(pos))
@@ -899,7 +1498,7 @@ public:
                 }
             }
             _currChunkIdx = _aiters[0]->getPosition()[0];
-            for(size_t i=0; i<_nAttrs; ++i)
+            for(size_t i=0; i<_nRead; ++i)
             {
                 _citers[i] = _aiters[i]->getChunk().getConstIterator();
                 if(!_citers[i]->setPosition(pos))
@@ -0,0 +1,335 @@
+/*
+**
+* BEGIN_COPYRIGHT
+*
+* Copyright (C) 2008-2016 SciDB, Inc.
+* All Rights Reserved.
+*
+* equi_join is a plugin for SciDB, an Open Source Array DBMS maintained
+* by Paradigm4. See http://www.paradigm4.com/
+*
+* equi_join is free software: you can redistribute it and/or modify
+* it under the terms of the AFFERO GNU General Public License as published by
+* the Free Software Foundation.
+*
+* equi_join is distributed "AS-IS" AND WITHOUT ANY WARRANTY OF ANY KIND,
+* INCLUDING ANY IMPLIED WARRANTY OF MERCHANTABILITY,
+* NON-INFRINGEMENT, OR FITNESS FOR A PARTICULAR PURPOSE. See
+* the AFFERO GNU General Public License for the complete license terms.
+*
+* You should have received a copy of the AFFERO GNU General Public License
+* along with equi_join.  If not, see <http://www.gnu.org/licenses/agpl-3.0.html>
+*
+* END_COPYRIGHT
+*/
+
+#ifndef COLLECTIVES_H
+#define COLLECTIVES_H
+
+#include <network/Network.h>
+#include <query/Query.h>
+#include <functional>
+#include <limits>
+
+#include "EquiJoinSettings.h"
+
+namespace scidb
+{
+namespace equi_join
+{
+
+/**
+ * Below this many bytes per instance, allReduce sends the whole buffer to every instance rather than slices of it.
+ */
+static size_t const ALL_REDUCE_MIN_SLICE = 4096;
+
+/**
+ * How allReduce sends a run of values and combines one it receives into its own: as they are, by default.
+ */
+template <typename T, typename REDUCE>
+struct SliceCodec
+{
+    static shared_ptr<SharedBuffer> encode(T const* values, size_t const count)
+    {
+        shared_ptr<SharedBuffer> buf(new MemoryBuffer(NULL, count * sizeof(T)));
+        memcpy(buf->getWriteData(), values, count * sizeof(T));
+        return buf;
+    }
+
+    static void reduceInto(T* values, size_t const count, shared_ptr<SharedBuffer>& buf, REDUCE const& reduce)
+    {
+        if(buf->getSize() != count * sizeof(T))
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "reducing unequal buffers";
+        }
+        T const* other = (T const*) buf->getWriteData();
+        for(size_t j=0; j<count; ++j)
+        {
+            values[j] = reduce(values[j], other[j]);
+        }
+    }
+
+    static void copyInto(T* values, size_t const count, shared_ptr<SharedBuffer>& buf)
+    {
+        if(buf->getSize() != count * sizeof(T))
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "reducing unequal buffers";
+        }
+        memcpy(values, buf->getWriteData(), count * sizeof(T));
+    }
+};
+
+/**
+ * Bit vectors OR-ed together, such as bloom filters, are sent in whichever of three encodings is smallest: the words as
+ * they are (RAW), the nonzero words with their indexes (WORDS), or the positions of the set bits (POSITIONS). Sparse
+ * filters then take a fraction of their size on the wire, and are OR-ed in straight from the encoded form.
+ */
+template <>
+struct SliceCodec<uint64_t, std::bit_or<uint64_t> >
+{
+    enum Encoding
+    {
+        RAW       = 0,
+        WORDS     = 1,  //uint32_t word index, uint64_t word
+        POSITIONS = 2   //uint32_t bit position
+    };
+
+    static size_t const WORD_ENTRY_SIZE = sizeof(uint32_t) + sizeof(uint64_t);
+
+    static shared_ptr<SharedBuffer> encode(uint64_t const* words, size_t const count)
+    {
+        size_t setWords = 0, setBits = 0;
+        for(size_t j=0; j<count; ++j)
+        {
+            if(words[j])
+            {
+                ++setWords;
+                setBits += __builtin_popcountll(words[j]);
+            }
+        }
+        size_t const rawSize = count * sizeof(uint64_t);
+        size_t const wordsSize = setWords * WORD_ENTRY_SIZE;
+        size_t const positionsSize = setBits * sizeof(uint32_t);
+        bool const indexable = count * 64 <= std::numeric_limits<uint32_t>::max();
+        uint64_t encoding = RAW;
+        size_t size = rawSize;
+        if(indexable && wordsSize < size)
+        {
+            encoding = WORDS;
+            size = wordsSize;
+        }
+        if(indexable && positionsSize < size)
+        {
+            encoding = POSITIONS;
+            size = positionsSize;
+        }
+        shared_ptr<SharedBuffer> buf(new MemoryBuffer(NULL, sizeof(uint64_t) + size));
+        char* ch = (char*) buf->getWriteData();
+        memcpy(ch, &encoding, sizeof(uint64_t));
+        ch += sizeof(uint64_t);
+        if(encoding == RAW)
+        {
+            memcpy(ch, words, rawSize);
+            return buf;
+        }
+        for(size_t j=0; j<count; ++j)
+        {
+            if(words[j] == 0)
+            {
+                continue;
+            }
+            uint32_t const index = j;
+            if(encoding == WORDS)
+            {
+                memcpy(ch, &index, sizeof(uint32_t));
+                memcpy(ch + sizeof(uint32_t), words + j, sizeof(uint64_t));
+                ch += WORD_ENTRY_SIZE;
+                continue;
+            }
+            for(uint64_t word = words[j]; word != 0; word &= word - 1)
+            {
+                uint32_t const position = index * 64 + __builtin_ctzll(word);
+                memcpy(ch, &position, sizeof(uint32_t));
+                ch += sizeof(uint32_t);
+            }
+        }
+        return buf;
+    }
+
+    static void reduceInto(uint64_t* words, size_t const count, shared_ptr<SharedBuffer>& buf, std::bit_or<uint64_t> const&)
+    {
+        if(buf->getSize() < sizeof(uint64_t))
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "reducing unequal bit vectors";
+        }
+        char const* ch = (char const*) buf->getWriteData();
+        size_t const size = buf->getSize() - sizeof(uint64_t);
+        uint64_t encoding;
+        memcpy(&encoding, ch, sizeof(uint64_t));
+        ch += sizeof(uint64_t);
+        if((encoding == RAW       && size != count * sizeof(uint64_t)) ||
+           (encoding == WORDS     && size % WORD_ENTRY_SIZE != 0) ||
+           (encoding == POSITIONS && size % sizeof(uint32_t) != 0) ||
+           encoding > POSITIONS)
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "reducing unequal bit vectors";
+        }
+        if(encoding == RAW)
+        {
+            for(size_t j=0; j<count; ++j, ch += sizeof(uint64_t))
+            {
+                uint64_t word;
+                memcpy(&word, ch, sizeof(uint64_t));
+                words[j] |= word;
+            }
+        }
+        else if(encoding == WORDS)
+        {
+            for(size_t j=0; j<size / WORD_ENTRY_SIZE; ++j, ch += WORD_ENTRY_SIZE)
+            {
+                uint32_t index;
+                uint64_t word;
+                memcpy(&index, ch, sizeof(uint32_t));
+                memcpy(&word, ch + sizeof(uint32_t), sizeof(uint64_t));
+                if(index >= count)
+                {
+                    throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "reducing unequal bit vectors";
+                }
+                words[index] |= word;
+            }
+        }
+        else
+        {
+            for(size_t j=0; j<size / sizeof(uint32_t); ++j, ch += sizeof(uint32_t))
+            {
+                uint32_t position;
+                memcpy(&position, ch, sizeof(uint32_t));
+                if(position / 64 >= count)
+                {
+                    throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "reducing unequal bit vectors";
+                }
+                words[position / 64] |= (1ULL << (position % 64));
+            }
+        }
+    }
+
+    static void copyInto(uint64_t* words, size_t const count, shared_ptr<SharedBuffer>& buf)
+    {
+        memset(words, 0, count * sizeof(uint64_t));
+        reduceInto(words, count, buf, std::bit_or<uint64_t>());
+    }
+};
+
+/**
+ * Send slice i of the count values, as allReduce splits them, from instance i to all others, so that every instance
+ * ends up with all the slices. REDUCE only picks the SliceCodec.
+ */
+template <typename T, typename REDUCE>
+void allGather(T* values, size_t const count, shared_ptr<Query> const& query)
+{
+    typedef SliceCodec<T, REDUCE> Codec;
+    size_t const nInstances = query->getInstancesCount();
+    InstanceID const myId = query->getInstanceID();
+    size_t const myStart = count * myId / nInstances;
+    size_t const myEnd   = count * (myId + 1) / nInstances;
+    shared_ptr<SharedBuffer> buf = Codec::encode(values + myStart, myEnd - myStart);
+    for(InstanceID i=0; i<nInstances; ++i)
+    {
+        if(i != myId)
+        {
+            BufSend(i, buf, query);
+        }
+    }
+    for(InstanceID i=0; i<nInstances; ++i)
+    {
+        if(i != myId)
+        {
+            size_t const start = count * i / nInstances;
+            size_t const end   = count * (i + 1) / nInstances;
+            shared_ptr<SharedBuffer> inBuf = BufReceive(i, query);
+            Codec::copyInto(values + start, end - start, inBuf);
+        }
+    }
+}
+
+/**
+ * Combine count values from every instance element-wise with reduce, which must be associative and commutative, and
+ * leave the result in values on all instances. All instances must call it at the same point with the same count.
+ * Large buffers are split into one slice per instance: each instance first receives and reduces its own slice from
+ * everyone (reduce-scatter), then sends the reduced slice to everyone (allgather). Each instance sends and receives
+ * about twice the buffer size in total, whatever the number of instances, and does 1/N of the reduction work.
+ * Small buffers are sent whole to every instance and reduced everywhere, in one round. Values go through SliceCodec.
+ */
+template <typename T, typename REDUCE>
+void allReduce(T* values, size_t const count, REDUCE const& reduce, shared_ptr<Query> const& query)
+{
+    typedef SliceCodec<T, REDUCE> Codec;
+    size_t const nInstances = query->getInstancesCount();
+    InstanceID const myId = query->getInstanceID();
+    if(nInstances == 1 || count == 0)
+    {
+        return;
+    }
+    if(count * sizeof(T) < nInstances * ALL_REDUCE_MIN_SLICE)
+    {
+        shared_ptr<SharedBuffer> buf = Codec::encode(values, count);
+        for(InstanceID i=0; i<nInstances; ++i)
+        {
+            if(i != myId)
+            {
+                BufSend(i, buf, query);
+            }
+        }
+        for(InstanceID i=0; i<nInstances; ++i)
+        {
+            if(i != myId)
+            {
+                shared_ptr<SharedBuffer> inBuf = BufReceive(i, query);
+                Codec::reduceInto(values, count, inBuf, reduce);
+            }
+        }
+        return;
+    }
+    size_t const myStart = count * myId / nInstances;
+    size_t const myEnd   = count * (myId + 1) / nInstances;
+    for(InstanceID i=0; i<nInstances; ++i)
+    {
+        if(i != myId)
+        {
+            size_t const start = count * i / nInstances;
+            size_t const end   = count * (i + 1) / nInstances;
+            BufSend(i, Codec::encode(values + start, end - start), query);
+        }
+    }
+    for(InstanceID i=0; i<nInstances; ++i)
+    {
+        if(i != myId)
+        {
+            shared_ptr<SharedBuffer> inBuf = BufReceive(i, query);
+            Codec::reduceInto(values + myStart, myEnd - myStart, inBuf, reduce);
+        }
+    }
+    allGather<T, REDUCE>(values, count, query);
+}
+
+/**
+ * Replace each of values with its sum over all instances.
+ */
+inline void globalSum(vector<size_t>& values, shared_ptr<Query> const& query)
+{
+    allReduce(&(values[0]), values.size(), std::plus<size_t>(), query);
+}
+
+/**
+ * @return true if all instances call this with true, false otherwise.
+ */
+inline bool agreeOnBoolean(bool const value, shared_ptr<Query> const& query)
+{
+    char agreed = value;
+    allReduce(&agreed, 1, std::logical_and<char>(), query);
+    return agreed;
+}
+
+} } //namespace scidb::equi_join
+
+#endif //COLLECTIVES_H
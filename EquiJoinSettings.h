@@ -63,10 +63,21 @@ static const char* const KW_CHUNK_SIZE = "chunk_size";
 static const char* const KW_ALGORITHM = "algorithm";
 static const char* const KW_KEEP_DIMS = "keep_dimensions";
 static const char* const KW_BLOOM_FILT_SZ = "bloom_filter_size";
+static const char* const KW_BLOOM_FILT_HASHES = "bloom_filter_hashes";
+static const char* const KW_BLOOM_FILT_FPR = "bloom_filter_fpr";
 static const char* const KW_FILTER = "filter";
 static const char* const KW_LEFT_OUTER = "left_outer";
 static const char* const KW_RIGHT_OUTER = "right_outer";
 static const char* const KW_OUT_NAMES = "out_names";
+static const char* const KW_THREADS = "threads";
+static const char* const KW_HYBRID_HASH = "hybrid_hash";
+static const char* const KW_MEMORY_LIMIT = "memory_limit";
+static const char* const KW_DICTIONARY_KEYS = "dictionary_keys";
+static const char* const KW_BROADCAST_TABLE = "broadcast_table";
+static const char* const KW_CACHE_TABLE = "cache_table";
+static const char* const KW_TABLE_CACHE_SIZE = "table_cache_size";
+static const char* const KW_SEMI = "semi";
+static const char* const KW_ANTI = "anti";
 
 typedef std::shared_ptr<OperatorParamLogicalExpression> ParamType_t ;
 
@@ -77,7 +88,9 @@ typedef std::shared_ptr<OperatorParamLogicalExpression> ParamType_t ;
  * usually more - depending on how many values and states there are and also whether they are variable sized.
  * An empty bucket is an 8-byte pointer. So the ratio of group data / bucket overhead is at least 16.
  * With that in mind we just pick a few primes for the most commonly used memory limits.
- * We start with that many buckets and, at the moment, we don't bother rehashing:
+ * The numbers below are also used to spread tuple hashes across instances. JoinHashTable does not allocate
+ * this many slots up front: it sizes itself from the expected tuple count (when the caller knows it) and
+ * doubles incrementally whenever it gets more than 3/4 full. The bucket count only caps the initial size:
  *
  * memory_limit_MB     max_groups    desired_buckets   nearest_prime   buckets_overhead_MB
  *             128        4194304            1048576         1048573                     8
@@ -117,6 +130,16 @@ enum Handedness
     RIGHT
 };
 
+//How the hash table represents join keys, picked from the key types; see KeyTraits in JoinHashTable
+enum KeyLayout
+{
+    KEYS_GENERIC,    //any key types: keys are hashed and compared as Values
+    KEYS_PACKED_64,  //all keys have fixed sizes that add up to 8 bytes or less: packed into one uint64
+    KEYS_PACKED_128  //all keys have fixed sizes that add up to 16 bytes or less: packed into one uint128
+};
+
+class KeyDictionary; //see ArrayIO
+
 class Settings
 {
 public:
@@ -125,7 +148,9 @@ public:
         HASH_REPLICATE_LEFT,
         HASH_REPLICATE_RIGHT,
         MERGE_LEFT_FIRST,
-        MERGE_RIGHT_FIRST
+        MERGE_RIGHT_FIRST,
+        RADIX_PARTITION_LEFT,
+        RADIX_PARTITION_RIGHT
     };
 
 private:
@@ -144,6 +169,10 @@ private:
     vector<size_t>                _leftIds;          //key indeces in the left array:  attributes start at 0, dimensions start at numAttrs
     vector<size_t>                _rightIds;        //key indeces in the right array: attributes start at 0, dimensions start at numAttrs
     vector<bool>                  _keyNullable;      //one per key, in the output
+    vector<bool>                  _keyIsString;      //one per key
+    vector<AttributeComparator>   _encodedKeyComparators; //one per key, for tupled arrays with string keys replaced by dictionary codes
+    KeyLayout                     _keyLayout;
+    size_t                        _keySize;
     size_t                        _hashJoinThreshold;
     size_t                        _numHashBuckets;
     size_t                        _chunkSize;
@@ -152,6 +181,17 @@ private:
     bool                          _algorithmSet;
     bool                          _keepDimensions;
     size_t                        _bloomFilterSize;
+    size_t                        _bloomFilterHashes;
+    double                        _bloomFilterFpr;
+    size_t                        _numThreads;
+    bool                          _hybridHash;
+    size_t                        _memoryLimit;
+    bool                          _memoryLimitSet;
+    bool                          _dictionaryKeys;
+    bool                          _broadcastTable;
+    bool                          _cacheTable;
+    size_t                        _tableCacheSize;
+    shared_ptr<KeyDictionary const> _keyDictionary;
     size_t                        _readAheadLimit;
     size_t                        _varSize;
     string                        _filterExpressionString;
@@ -160,6 +200,8 @@ private:
     vector<string>                _rightNames;
     bool                          _leftOuter;
     bool                          _rightOuter;
+    bool                          _semiJoin;
+    bool                          _antiJoin;
     vector<string>                _outNames;
 
     void setParamIds(vector<int64_t> content, vector<size_t> &keys, size_t shift)
@@ -257,6 +299,14 @@ private:
         {
             _algorithm = MERGE_RIGHT_FIRST;
         }
+        else if (trimmedContent == "radix_partition_left")
+        {
+            _algorithm = RADIX_PARTITION_LEFT;
+        }
+        else if (trimmedContent == "radix_partition_right")
+        {
+            _algorithm = RADIX_PARTITION_RIGHT;
+        }
         else
         {
             throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "could not parse algorithm";
@@ -296,6 +346,47 @@ private:
         _bloomFilterSize = res;
     }
 
+    void setParamBloomFilterHashes(vector<int64_t> content)
+    {
+        int64_t res = content[0];
+        if(res < 0)
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "bloom filter hashes must be non-negative";
+        }
+        _bloomFilterHashes = res;
+    }
+
+    void setParamThreads(vector<int64_t> content)
+    {
+        int64_t res = content[0];
+        if(res <= 0)
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "number of threads must be positive";
+        }
+        _numThreads = res;
+    }
+
+    void setParamTableCacheSize(vector<int64_t> content)
+    {
+        int64_t res = content[0];
+        if(res < 0)
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "table cache size must be non negative";
+        }
+        _tableCacheSize = res * 1024 * 1024;
+    }
+
+    void setParamMemoryLimit(vector<int64_t> content)
+    {
+        int64_t res = content[0];
+        if(res < 0)
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "memory limit must be non negative";
+        }
+        _memoryLimit = res * 1024 * 1024;
+        _memoryLimitSet = true;
+    }
+
     void setParamLeftOuter(string trimmedContent)
     {
         if(!setParamBool(trimmedContent, _leftOuter))
@@ -464,6 +555,34 @@ private:
         }
     }
 
+    double getParamContentDouble(Parameter& param)
+    {
+        double paramContent;
+
+        if(param->getParamType() == PARAM_LOGICAL_EXPRESSION) {
+            ParamType_t& paramExpr = reinterpret_cast<ParamType_t&>(param);
+            paramContent = evaluate(paramExpr->getExpression(), TID_DOUBLE).getDouble();
+        } else {
+            OperatorParamPhysicalExpression* exp =
+                dynamic_cast<OperatorParamPhysicalExpression*>(param.get());
+            SCIDB_ASSERT(exp != nullptr);
+            paramContent = exp->getExpression()->evaluate().getDouble();
+        }
+        return paramContent;
+    }
+
+    void setKeywordParamDouble(KeywordParameters const& kwParams, const char* const kw, double& value)
+    {
+        Parameter kwParam = getKeywordParam(kwParams, kw);
+        if (kwParam) {
+            double paramContent = getParamContentDouble(kwParam);
+            LOG4CXX_DEBUG(logger, "EJ setting " << kw << " to " << paramContent);
+            value = paramContent;
+        } else {
+            LOG4CXX_DEBUG(logger, "EJ findKeyword null: " << kw);
+        }
+    }
+
     Parameter getKeywordParam(KeywordParameters const& kwp, const std::string& kw) const
     {
         auto const& kwPair = kwp.find(kw);
@@ -483,6 +602,8 @@ public:
         _numLeftDims(_leftSchema.getDimensions().size()),
         _numRightAttrs(_rightSchema.getAttributes(true).size()),
         _numRightDims(_rightSchema.getDimensions().size()),
+        _keyLayout(KEYS_GENERIC),
+        _keySize(0),
         _hashJoinThreshold(Config::getInstance()->getOption<int>(CONFIG_MERGE_SORT_BUFFER) * 1024 * 1024 ),
         _numHashBuckets(chooseNumBuckets(_hashJoinThreshold / (1024*1024))),
         _chunkSize(1000000),
@@ -490,11 +611,23 @@ public:
         _algorithm(HASH_REPLICATE_RIGHT),
         _algorithmSet(kwParams.find(KW_ALGORITHM) != kwParams.end()),
         _keepDimensions(false),
-        _bloomFilterSize(33554467), //about 4MB, why not?
+        _bloomFilterSize(33554467), //about 4MB, the most a filter may take unless set
+        _bloomFilterHashes(0),      //chosen from the number of keys
+        _bloomFilterFpr(0.01),
+        _numThreads(1),
+        _hybridHash(false),
+        _memoryLimit(0),
+        _memoryLimitSet(false),
+        _dictionaryKeys(false),
+        _broadcastTable(false),
+        _cacheTable(false),
+        _tableCacheSize(Config::getInstance()->getOption<int>(CONFIG_MEM_ARRAY_THRESHOLD) * 1024 * 1024 / 4),
         _filterExpressionString(""),
         _filterExpression(NULL),
         _leftOuter(false),
         _rightOuter(false),
+        _semiJoin(false),
+        _antiJoin(false),
         _outNames(0)
     {
         string const outNamesHeader                = "out_names=";
@@ -509,8 +642,23 @@ public:
         setKeywordParamString(kwParams, KW_ALGORITHM, &Settings::setParamAlgorithm);
         setKeywordParamBool(kwParams, KW_KEEP_DIMS, _keepDimensions);
         setKeywordParamInt64(kwParams, KW_BLOOM_FILT_SZ, &Settings::setParamBloomFilterSize);
+        setKeywordParamInt64(kwParams, KW_BLOOM_FILT_HASHES, &Settings::setParamBloomFilterHashes);
+        setKeywordParamDouble(kwParams, KW_BLOOM_FILT_FPR, _bloomFilterFpr);
+        setKeywordParamInt64(kwParams, KW_THREADS, &Settings::setParamThreads);
+        setKeywordParamBool(kwParams, KW_HYBRID_HASH, _hybridHash);
+        if(kwParams.find(KW_MEMORY_LIMIT) == kwParams.end())
+        {
+            _memoryLimit = 4 * std::max<size_t>(_hashJoinThreshold, Config::getInstance()->getOption<int>(CONFIG_MERGE_SORT_BUFFER) * 1024 * 1024);
+        }
+        setKeywordParamInt64(kwParams, KW_MEMORY_LIMIT, &Settings::setParamMemoryLimit);
+        setKeywordParamBool(kwParams, KW_DICTIONARY_KEYS, _dictionaryKeys);
+        setKeywordParamBool(kwParams, KW_BROADCAST_TABLE, _broadcastTable);
+        setKeywordParamBool(kwParams, KW_CACHE_TABLE, _cacheTable);
+        setKeywordParamInt64(kwParams, KW_TABLE_CACHE_SIZE, &Settings::setParamTableCacheSize);
         setKeywordParamBool(kwParams, KW_LEFT_OUTER, _leftOuter);
         setKeywordParamBool(kwParams, KW_RIGHT_OUTER, _rightOuter);
+        setKeywordParamBool(kwParams, KW_SEMI, _semiJoin);
+        setKeywordParamBool(kwParams, KW_ANTI, _antiJoin);
         setKeywordParamJoinField(kwParams, KW_OUT_NAMES, &Settings::setParamOutNames);
         setKeywordParamString(kwParams, KW_FILTER, &Settings::setParamFilterExpression);
 
@@ -653,8 +801,15 @@ private:
             TypeId rightType  = rightKey < _numRightAttrs ? _rightSchema.getAttributes(true).findattr(rightKey).getType() : TID_INT64;
             throwIf(leftType != rightType, "key types do not match");
         }
+        throwIf( !(_bloomFilterFpr > 0 && _bloomFilterFpr < 1), "bloom_filter_fpr must be between 0 and 1");
+        throwIf( _semiJoin && _antiJoin, "semi and anti cannot both be set");
+        throwIf( (_semiJoin || _antiJoin) && (_leftOuter || _rightOuter), "semi and anti joins cannot be outer joins");
+        throwIf( (_semiJoin || _antiJoin) && _algorithmSet && (_algorithm == HASH_REPLICATE_LEFT || _algorithm == RADIX_PARTITION_LEFT),
+                 "semi and anti joins keep the right array in the table; left replicate and left radix partition algorithms cannot be used");
         throwIf( _algorithmSet && _algorithm == HASH_REPLICATE_LEFT  && isLeftOuter(),  "left replicate algorithm cannot be used for left  outer join");
         throwIf( _algorithmSet && _algorithm == HASH_REPLICATE_RIGHT && isRightOuter(), "right replicate algorithm cannot be used for right outer join");
+        throwIf( _algorithmSet && _algorithm == RADIX_PARTITION_LEFT  && isLeftOuter(),  "left radix partition algorithm cannot be used for left  outer join");
+        throwIf( _algorithmSet && _algorithm == RADIX_PARTITION_RIGHT && isRightOuter(), "right radix partition algorithm cannot be used for right outer join");
     }
 
     void mapAttributes()
@@ -662,6 +817,8 @@ private:
         _numKeys = _leftIds.size();
         _leftMapToTuple.resize(_numLeftAttrs + _numLeftDims, -1);
         _rightMapToTuple.resize(_numRightAttrs + _numRightDims, -1);
+        size_t totalKeySize = 0;
+        bool keysFixedSize = true;
         for(size_t i =0; i<_numKeys; ++i)
         {
             size_t leftKey  = _leftIds[i];
@@ -673,9 +830,18 @@ private:
             TypeId leftType   = leftKey  < _numLeftAttrs  ? _leftSchema.getAttributes(true).findattr(leftKey).getType()   : TID_INT64;
             bool leftNullable  = leftKey  < _numLeftAttrs  ?  _leftSchema.getAttributes(true).findattr(leftKey).isNullable()   : false;
             bool rightNullable = rightKey < _numRightAttrs  ? _rightSchema.getAttributes(true).findattr(rightKey).isNullable() : false;
+            size_t keySize     = leftKey  < _numLeftAttrs  ?  _leftSchema.getAttributes(true).findattr(leftKey).getSize()       : sizeof(Coordinate);
             _keyComparators.push_back(AttributeComparator(leftType));
             _keyNullable.push_back( leftNullable || rightNullable );
+            _keyIsString.push_back(leftType == TID_STRING);
+            _encodedKeyComparators.push_back(AttributeComparator(leftType == TID_STRING ? TID_INT64 : leftType));
+            keysFixedSize = keysFixedSize && keySize != 0;
+            totalKeySize += keySize;
         }
+        _keyLayout = !keysFixedSize      ? KEYS_GENERIC :
+                     totalKeySize <= 8  ? KEYS_PACKED_64 :
+                     totalKeySize <= 16 ? KEYS_PACKED_128 : KEYS_GENERIC;
+        _keySize = keysFixedSize ? totalKeySize : 0;
         size_t j=_numKeys;
         for(size_t i =0; i<_numLeftAttrs + _numLeftDims; ++i)
         {
@@ -688,7 +854,7 @@ private:
         j = _numKeys;
         for(size_t i =0; i<_numRightAttrs + _numRightDims; ++i)
         {
-            if(_rightMapToTuple[i] == -1 && (i<_numRightAttrs || _keepDimensions))
+            if(_rightMapToTuple[i] == -1 && (i<_numRightAttrs || _keepDimensions) && !_semiJoin && !_antiJoin) //only the keys are needed to filter
             {
                 _rightMapToTuple[i] = j++;
             }
@@ -767,8 +933,20 @@ private:
         output<<" chunk "<<_chunkSize;
         output<<" keep_dimensions "<<_keepDimensions;
         output<<" bloom filter size "<<_bloomFilterSize;
+        output<<" bloom filter hashes "<<_bloomFilterHashes;
+        output<<" bloom filter fpr "<<_bloomFilterFpr;
+        output<<" threads "<<_numThreads;
+        output<<" hybrid hash "<<_hybridHash;
+        output<<" memory limit "<<_memoryLimit;
+        output<<" dictionary keys "<<_dictionaryKeys;
+        output<<" broadcast table "<<_broadcastTable;
+        output<<" cache table "<<_cacheTable;
+        output<<" table cache size "<<_tableCacheSize;
         output<<" left outer "<<_leftOuter;
         output<<" right outer "<<_rightOuter;
+        output<<" semi "<<_semiJoin;
+        output<<" anti "<<_antiJoin;
+        output<<" key layout "<<_keyLayout;
         LOG4CXX_DEBUG(logger, "EJ keys "<<output.str().c_str());
     }
 
@@ -778,6 +956,19 @@ public:
         return _numKeys;
     }
 
+    KeyLayout getKeyLayout() const
+    {
+        return _keyLayout;
+    }
+
+    /**
+     * @return the total size of the join keys in bytes if all of them have a fixed size, 0 otherwise
+     */
+    size_t getKeySize() const
+    {
+        return _keySize;
+    }
+
     size_t getNumLeftAttrs() const
     {
         return _numLeftAttrs;
@@ -880,6 +1071,66 @@ public:
         return _keyComparators;
     }
 
+    /**
+     * @return the comparators for the keys of tupled arrays, which hold dictionary codes in place of strings once a
+     * KeyDictionary is set
+     */
+    vector <AttributeComparator> const& getTupledKeyComparators() const
+    {
+        return _keyDictionary ? _encodedKeyComparators : _keyComparators;
+    }
+
+    bool useDictionaryKeys() const
+    {
+        return _dictionaryKeys;
+    }
+
+    bool broadcastTable() const
+    {
+        return _broadcastTable;
+    }
+
+    bool cacheTable() const
+    {
+        return _cacheTable;
+    }
+
+    /**
+     * @return the most bytes of tables the instance keeps in its TableCache, once this query adds one
+     */
+    size_t getTableCacheSize() const
+    {
+        return _tableCacheSize;
+    }
+
+    bool hasStringKeys() const
+    {
+        return std::find(_keyIsString.begin(), _keyIsString.end(), true) != _keyIsString.end();
+    }
+
+    bool isKeyString(size_t const keyIdx) const
+    {
+        return _keyIsString[keyIdx];
+    }
+
+    /**
+     * @return true if the key is replaced by its dictionary code in tupled arrays
+     */
+    bool isKeyEncoded(size_t const keyIdx) const
+    {
+        return _keyDictionary && _keyIsString[keyIdx];
+    }
+
+    KeyDictionary const* getKeyDictionary() const
+    {
+        return _keyDictionary.get();
+    }
+
+    void setKeyDictionary(shared_ptr<KeyDictionary const> const& dictionary)
+    {
+        _keyDictionary = dictionary;
+    }
+
     algorithm getAlgorithm() const
     {
         return _algorithm;
@@ -895,11 +1146,57 @@ public:
         return _hashJoinThreshold;
     }
 
+    /**
+     * The size of bloom filters in bits. A filter whose number of keys is known in advance is made just large enough
+     * for getBloomFilterFpr, and this is then the most it may take.
+     */
     size_t getBloomFilterSize() const
     {
         return _bloomFilterSize;
     }
 
+    /**
+     * The false positive rate that bloom filters are sized for, when the number of keys is known.
+     */
+    double getBloomFilterFpr() const
+    {
+        return _bloomFilterFpr;
+    }
+
+    /**
+     * The number of bits set per key in bloom filters, or 0 to choose it from the expected number of keys.
+     */
+    size_t getBloomFilterHashes() const
+    {
+        return _bloomFilterHashes;
+    }
+
+    size_t getNumThreads() const
+    {
+        return _numThreads;
+    }
+
+    bool useHybridHash() const
+    {
+        return _hybridHash;
+    }
+
+    /**
+     * @return the most bytes a hash table may take on one instance before it is abandoned, or 0 for no limit
+     */
+    size_t getMemoryLimit() const
+    {
+        return _memoryLimit;
+    }
+
+    /**
+     * @return true if memory_limit was given, rather than defaulted
+     */
+    bool isMemoryLimitSet() const
+    {
+        return _memoryLimitSet;
+    }
+
     shared_ptr<Expression> const& getFilterExpression() const
     {
         return _filterExpression;
@@ -910,11 +1207,40 @@ public:
         return _leftOuter;
     }
 
+    /**
+     * @return true if left tuples without a match must still reach the ArrayWriter: for left outer joins, and for semi
+     * and anti joins, which run as left outer joins against the keys of the right array. The left array is then never
+     * put in a table and its tuples with null keys are kept; the ArrayWriter drops the misses (semi) or the matches
+     * (anti), and the algorithms stop at the first match of a left tuple.
+     */
+    bool needsLeftMisses() const
+    {
+        return _leftOuter || _semiJoin || _antiJoin;
+    }
+
     bool isRightOuter() const
     {
         return _rightOuter;
     }
 
+    bool isSemiJoin() const
+    {
+        return _semiJoin;
+    }
+
+    bool isAntiJoin() const
+    {
+        return _antiJoin;
+    }
+
+    /**
+     * @return true if each left tuple is output at most once, without any right fields
+     */
+    bool isSemiOrAntiJoin() const
+    {
+        return _semiJoin || _antiJoin;
+    }
+
     ArrayDesc const& getLeftSchema() const
     {
         return _leftSchema;
@@ -968,7 +1294,7 @@ public:
         i = 0;
         for(const auto& input : _rightSchema.getAttributes(true))
         {
-            if(isRightKey(i)) //already in the schema
+            if(isRightKey(i) || mapRightToOutput(i) < 0) //already in the schema, or not output
             {
                 i++;
                 continue;
@@ -31,7 +31,12 @@
 #include <array/SortArray.h>
 #include <array/TupleArray.h>
 #include <system/Config.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define EJ_SIMD_HASH 1
+#endif
 
+#include "MurmurHash/MurmurHash3.h"
 #include "EquiJoinSettings.h"
 
 namespace scidb
@@ -71,6 +76,86 @@ bool isNullTuple(TUPLE_TYPE const& tuple, size_t const numKeys)
     return false;
 }
 
+static size_t const EMPTY     = static_cast<size_t>(-1); //marks an unused slot or the end of a group
+static size_t const MOVED     = static_cast<size_t>(-2); //marks an old slot whose group has been rehashed into the new array
+static size_t const MIN_SLOTS = 1024;
+static size_t const REHASH_STEP = 8;                     //old slots migrated per insert while a rehash is in progress
+static size_t const MIN_ROW_PAGE_SIZE = 4096;            //stored tuples are packed into arena pages that start at this size
+static size_t const ROW_PAGE_SIZE = 1024 * 1024;         //and double up to this one
+static size_t const RADIX_PARTITION_SIZE = 256 * 1024;   //target footprint of one partition of a PartitionedJoinHashTable: about an L2 cache
+static size_t const MAX_RADIX_PARTITIONS = 4096;
+static size_t const RADIX_MIN_TABLE_SIZE = 64 * 1024 * 1024; //tables at least this large are partitioned unless the user picked an algorithm
+static size_t const RADIX_BATCH_SIZE = 16384;            //probe tuples gathered and sorted by partition at a time
+static size_t const PROBE_BATCH_SIZE = 128;              //tuples looked up together by const_iterator::findBatch
+static size_t const MAX_HYBRID_PARTITIONS = 256;         //partitions of a hybrid hash join that can each be spilled separately
+static size_t const MEMORY_CHECK_INTERVAL = 4096;        //tuples added to a table between checks of its footprint against Settings::getMemoryLimit
+static size_t const DIRECT_MAX_SPREAD = 4;               //keys are addressed directly when their range is at most this many times the row count
+static size_t const GROUP_MIN_ROWS_PER_KEY = 2;          //rows are stored grouped under their keys when there are at least this many per key
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+/**
+ * What a JoinHashTable slot keeps about its keys, per KeyLayout. With KEYS_GENERIC that is the 64-bit murmur hash of the
+ * keys, a fingerprint checked before the key Values are compared. The packed layouts keep the raw bytes of all keys
+ * in one integer instead: two groups are equal iff their integers are, and the hash is a cheap mix of the integer.
+ */
+template <KeyLayout LAYOUT>
+struct KeyTraits;
+
+template <>
+struct KeyTraits<KEYS_GENERIC>
+{
+    typedef uint64_t Key;
+    static bool const PACKED = false;
+
+    static size_t hash(Key const key)
+    {
+        return key;
+    }
+};
+
+template <>
+struct KeyTraits<KEYS_PACKED_64>
+{
+    typedef uint64_t Key;
+    static bool const PACKED = true;
+
+    static size_t hash(Key const key)
+    {
+        return fmix(key);
+    }
+};
+
+template <>
+struct KeyTraits<KEYS_PACKED_128>
+{
+    typedef uint128_t Key;
+    static bool const PACKED = true;
+
+    static size_t hash(Key const key)
+    {
+        return fmix(static_cast<uint64_t>(key) ^ fmix(static_cast<uint64_t>(key >> 64)));
+    }
+};
+
+/**
+ * Copy the keys back to back into a KEY. Settings only picks a packed layout when every key type has a fixed size
+ * and they all fit, so each key always lands at the same offset. Keys must not be null.
+ */
+template <typename KEY>
+KEY packKeys(vector<Value const*> const& keys, size_t const numKeys)
+{
+    KEY result = 0;
+    char* dst = reinterpret_cast<char*>(&result);
+    for(size_t i =0; i<numKeys; ++i)
+    {
+        memcpy(dst, keys[i]->data(), keys[i]->size());
+        dst += keys[i]->size();
+    }
+    return result;
+}
+
+template <KeyLayout LAYOUT = KEYS_GENERIC>
 class JoinHashTable
 {
 private:
@@ -78,6 +163,7 @@ private:
     // MurmurHash3 was written by Austin Appleby, and is placed in the public
     // domain. The author hereby disclaims copyright to this source code.
 #define ROT32(x, y) ((x << y) | (x >> (32 - y))) // avoid effort
+#define ROT64(x, y) ((x << y) | (x >> (64 - y)))
 
 public:
     static uint32_t murmur3_32(char const* key, uint32_t len, uint32_t const seed = 0x5C1DB123)
@@ -125,17 +211,220 @@ public:
         hash ^= (hash >> 16);
         return hash;
     }
+
+    /**
+     * The first 64 bits of MurmurHash3_x64_128, which takes the key 16 bytes at a time.
+     */
+    static uint64_t murmur3_64(char const* key, size_t const len, uint64_t const seed = 0x5C1DB123)
+    {
+        static const uint64_t c1 = 0x87c37b91114253d5ULL;
+        static const uint64_t c2 = 0x4cf5ad432745937fULL;
+        uint64_t h1 = seed;
+        uint64_t h2 = seed;
+        size_t const nblocks = len / 16;
+        for(size_t i = 0; i < nblocks; i++)
+        {
+            uint64_t k1, k2;
+            memcpy(&k1, key + i * 16, 8);
+            memcpy(&k2, key + i * 16 + 8, 8);
+            k1 *= c1; k1 = ROT64(k1, 31); k1 *= c2; h1 ^= k1;
+            h1 = ROT64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+            k2 *= c2; k2 = ROT64(k2, 33); k2 *= c1; h2 ^= k2;
+            h2 = ROT64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+        }
+        const uint8_t *tail = (const uint8_t *) (key + nblocks * 16);
+        uint64_t k1 = 0;
+        uint64_t k2 = 0;
+        switch(len & 15)
+        {
+        case 15: k2 ^= ((uint64_t) tail[14]) << 48;
+        case 14: k2 ^= ((uint64_t) tail[13]) << 40;
+        case 13: k2 ^= ((uint64_t) tail[12]) << 32;
+        case 12: k2 ^= ((uint64_t) tail[11]) << 24;
+        case 11: k2 ^= ((uint64_t) tail[10]) << 16;
+        case 10: k2 ^= ((uint64_t) tail[ 9]) << 8;
+        case  9: k2 ^= ((uint64_t) tail[ 8]) << 0;
+                 k2 *= c2; k2 = ROT64(k2, 33); k2 *= c1; h2 ^= k2;
+        case  8: k1 ^= ((uint64_t) tail[ 7]) << 56;
+        case  7: k1 ^= ((uint64_t) tail[ 6]) << 48;
+        case  6: k1 ^= ((uint64_t) tail[ 5]) << 40;
+        case  5: k1 ^= ((uint64_t) tail[ 4]) << 32;
+        case  4: k1 ^= ((uint64_t) tail[ 3]) << 24;
+        case  3: k1 ^= ((uint64_t) tail[ 2]) << 16;
+        case  2: k1 ^= ((uint64_t) tail[ 1]) << 8;
+        case  1: k1 ^= ((uint64_t) tail[ 0]) << 0;
+                 k1 *= c1; k1 = ROT64(k1, 31); k1 *= c2; h1 ^= k1;
+        }
+        h1 ^= len;
+        h2 ^= len;
+        h1 += h2;
+        h2 += h1;
+        h1 = fmix(h1);
+        h2 = fmix(h2);
+        h1 += h2;
+        return h1;
+    }
     //End of MurmurHash3 Implementation
     //-----------------------------------------------------------------------------
 
 private:
-    struct HashTableEntry
+#ifdef EJ_SIMD_HASH
+    /**
+     * murmur3_32 of 8 keys at a time, one per vector lane; len must be a multiple of 4. Stops at the last full group of
+     * lanes and returns the number of keys hashed.
+     */
+    __attribute__((target("avx2")))
+    static size_t murmur3_32Avx2(char const* keys, uint32_t const len, size_t const count, uint32_t* hashes, uint32_t const seed)
+    {
+        __m256i const c1 = _mm256_set1_epi32(0xcc9e2d51);
+        __m256i const c2 = _mm256_set1_epi32(0x1b873593);
+        __m256i const m  = _mm256_set1_epi32(5);
+        __m256i const n  = _mm256_set1_epi32(0xe6546b64);
+        __m256i const offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(len));
+        size_t i = 0;
+        for(; i + 8 <= count; i += 8)
+        {
+            char const* base = keys + i * len;
+            __m256i hash = _mm256_set1_epi32(seed);
+            for(uint32_t b = 0; b < len; b += 4)
+            {
+                __m256i k = _mm256_i32gather_epi32(reinterpret_cast<int const*>(base + b), offsets, 1);
+                k = _mm256_mullo_epi32(k, c1);
+                k = _mm256_or_si256(_mm256_slli_epi32(k, 15), _mm256_srli_epi32(k, 17));
+                k = _mm256_mullo_epi32(k, c2);
+                hash = _mm256_xor_si256(hash, k);
+                hash = _mm256_or_si256(_mm256_slli_epi32(hash, 13), _mm256_srli_epi32(hash, 19));
+                hash = _mm256_add_epi32(_mm256_mullo_epi32(hash, m), n);
+            }
+            hash = _mm256_xor_si256(hash, _mm256_set1_epi32(len));
+            hash = _mm256_xor_si256(hash, _mm256_srli_epi32(hash, 16));
+            hash = _mm256_mullo_epi32(hash, _mm256_set1_epi32(0x85ebca6b));
+            hash = _mm256_xor_si256(hash, _mm256_srli_epi32(hash, 13));
+            hash = _mm256_mullo_epi32(hash, _mm256_set1_epi32(0xc2b2ae35));
+            hash = _mm256_xor_si256(hash, _mm256_srli_epi32(hash, 16));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(hashes + i), hash);
+        }
+        return i;
+    }
+
+    /**
+     * Same as murmur3_32Avx2, 4 keys at a time.
+     */
+    __attribute__((target("sse4.1")))
+    static size_t murmur3_32Sse41(char const* keys, uint32_t const len, size_t const count, uint32_t* hashes, uint32_t const seed)
+    {
+        __m128i const c1 = _mm_set1_epi32(0xcc9e2d51);
+        __m128i const c2 = _mm_set1_epi32(0x1b873593);
+        __m128i const m  = _mm_set1_epi32(5);
+        __m128i const n  = _mm_set1_epi32(0xe6546b64);
+        size_t i = 0;
+        for(; i + 4 <= count; i += 4)
+        {
+            char const* base = keys + i * len;
+            __m128i hash = _mm_set1_epi32(seed);
+            for(uint32_t b = 0; b < len; b += 4)
+            {
+                int32_t k0, k1, k2, k3;
+                memcpy(&k0, base + b, 4);
+                memcpy(&k1, base + len + b, 4);
+                memcpy(&k2, base + 2 * len + b, 4);
+                memcpy(&k3, base + 3 * len + b, 4);
+                __m128i k = _mm_setr_epi32(k0, k1, k2, k3);
+                k = _mm_mullo_epi32(k, c1);
+                k = _mm_or_si128(_mm_slli_epi32(k, 15), _mm_srli_epi32(k, 17));
+                k = _mm_mullo_epi32(k, c2);
+                hash = _mm_xor_si128(hash, k);
+                hash = _mm_or_si128(_mm_slli_epi32(hash, 13), _mm_srli_epi32(hash, 19));
+                hash = _mm_add_epi32(_mm_mullo_epi32(hash, m), n);
+            }
+            hash = _mm_xor_si128(hash, _mm_set1_epi32(len));
+            hash = _mm_xor_si128(hash, _mm_srli_epi32(hash, 16));
+            hash = _mm_mullo_epi32(hash, _mm_set1_epi32(0x85ebca6b));
+            hash = _mm_xor_si128(hash, _mm_srli_epi32(hash, 13));
+            hash = _mm_mullo_epi32(hash, _mm_set1_epi32(0xc2b2ae35));
+            hash = _mm_xor_si128(hash, _mm_srli_epi32(hash, 16));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(hashes + i), hash);
+        }
+        return i;
+    }
+
+    static int simdLevel() //2 for AVX2, 1 for SSE4.1, 0 for neither; checked once
+    {
+        static int const level = (__builtin_cpu_init(), __builtin_cpu_supports("avx2") ? 2 : __builtin_cpu_supports("sse4.1") ? 1 : 0);
+        return level;
+    }
+#endif
+
+public:
+    /**
+     * Compute murmur3_32 of count keys of len bytes each, stored back to back. Uses AVX2 or SSE4.1 when the CPU has them
+     * and len is a multiple of 4, as it is for most fixed-size keys, and the scalar version otherwise; the hashes are the
+     * same either way.
+     */
+    static void murmur3_32Batch(char const* keys, uint32_t const len, size_t const count, uint32_t* hashes, uint32_t const seed = 0x5C1DB123)
+    {
+        size_t done = 0;
+#ifdef EJ_SIMD_HASH
+        if(len % 4 == 0 && len != 0)
+        {
+            int const level = simdLevel();
+            if(level == 2)
+            {
+                done = murmur3_32Avx2(keys, len, count, hashes, seed);
+            }
+            else if(level == 1)
+            {
+                done = murmur3_32Sse41(keys, len, count, hashes, seed);
+            }
+        }
+#endif
+        for(; done < count; ++done)
+        {
+            hashes[done] = murmur3_32(keys + done * len, len, seed);
+        }
+    }
+
+private:
+    /**
+     * The table is open-addressed: one slot per group of tuples with identical keys, all slots in one contiguous array,
+     * probed linearly. Each slot keeps the Key of the group (see KeyTraits) and the row number of the most recently
+     * added tuple in the group; the other tuples of the group are linked through _nextInGroup. Looking up a key usually costs a
+     * single cache line and no pointer chasing.
+     *
+     * The table starts out sized for the expected number of tuples (or MIN_SLOTS if unknown) and doubles when it gets
+     * more than 3/4 full. Doubling is incremental: the old array is kept around and every insert moves REHASH_STEP of
+     * its slots into the new one, so no single insert pays for re-placing the whole table. Migrated old slots are
+     * marked MOVED so that probe sequences through them stay intact. Until the old array drains, lookups check it
+     * first; a group is only ever present in one of the two arrays.
+     *
+     * Tuples are not kept as Values. Each one is packed into a row of bytes, one field after another, and rows are
+     * laid back to back in pages allocated from the arena, which start small and grow with the table; _rows holds the start of every row. A field is its missing
+     * reason (one byte, -1 when not null), then for non-null values the size (one byte, or 0xFF and four more bytes)
+     * and the data. An int64 takes 10 bytes instead of a Value, strings need no allocation of their own, and rows never
+     * move once written. Keys are compared straight off the packed row; the iterator unpacks a row into Values only
+     * when the caller asks for the tuple.
+     *
+     * With KEYS_PACKED_64, buildIndex may find that the keys of a fresh table are dense: a dimension, or an integer
+     * attribute that spans little more than the number of rows. Then _slots is instead indexed by key minus the
+     * smallest key, one slot per possible value, and a lookup is a single load with no hashing or probing. Duplicates
+     * are linked through _nextInGroup as usual, so iterators see no difference. A key later inserted outside of the
+     * range turns the table back into a hashed one.
+     *
+     * When buildIndex finds GROUP_MIN_ROWS_PER_KEY or more rows per group, it also rewrites the rows grouped: the keys
+     * once, followed by the non-key fields of every row in the group back to back. Rows are renumbered so that each
+     * group is a contiguous run, whose first row (the one in the slot) holds the keys; _groupHead then replaces
+     * _nextInGroup. A probe compares keys once per group and streams the rest. Adding rows to a grouped table first
+     * gives each row its keys back. Both rewrites copy the rows out to the heap and lay them back over the pages
+     * they came from, so the arena footprint only grows by what no longer fits. The copy briefly doubles the row
+     * bytes, so rows are left ungrouped when that would take the table over Settings::getMemoryLimit.
+     */
+    typedef KeyTraits<LAYOUT>          Traits;
+    typedef typename Traits::Key       Key;
+
+    struct HashTableSlot
     {
-        size_t idx;
-        HashTableEntry* next;
-        HashTableEntry(size_t const idx, HashTableEntry* next):
-            idx(idx), next(next)
-        {}
+        size_t row;
+        Key    key;
     };
 
     Settings const&                          _settings;
@@ -143,29 +432,94 @@ private:
     size_t const                             _numAttributes;
     size_t const                             _numKeys;
     vector<AttributeComparator>              _keyComparators;
-    size_t const                             _numHashBuckets;
-    mgd::vector<HashTableEntry*>             _buckets;
-    std::vector<Value>                       _values;
-    ssize_t                                  _largeValueMemory;
-    size_t                                   _numHashes;
+    size_t                                   _numSlots;    //always a power of 2
+    size_t                                   _slotMask;
+    std::vector<HashTableSlot>               _slots;
+    std::vector<HashTableSlot>               _oldSlots;    //non-empty only while a rehash is in progress
+    size_t                                   _oldSlotMask;
+    size_t                                   _rehashPos;
+    std::vector<size_t>                      _nextInGroup; //one per row, unless grouped
+    std::vector<size_t>                      _groupHead;   //one per row if grouped: the first row of its group
+    bool                                     _grouped;
+    std::vector<char const*>                 _rows;
+    std::vector<Key>                         _pendingKeys; //of rows added by append() and not yet indexed
+    std::vector<char*>                       _pages;
+    std::vector<size_t>                      _pageSizes;
+    char*                                    _pageEnd;     //free space in the last page
+    size_t                                   _pageFree;
+    size_t                                   _rowBytes;
     size_t                                   _numGroups;
+    bool                                     _direct;      //_slots is indexed by key - _directMin
+    Key                                      _directMin;
     mutable vector<char>                     _hashBuf;
 
+    static size_t roundUpToPowerOf2(size_t n)
+    {
+        size_t result = 1;
+        while(result < n)
+        {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    /**
+     * Enough slots to hold expectedTuples distinct keys without a rehash, but never more than the bucket count the
+     * settings derive from hash_join_threshold.
+     */
+    static size_t chooseInitialNumSlots(Settings const& settings, size_t expectedTuples)
+    {
+        size_t const maxSlots = roundUpToPowerOf2(settings.getNumHashBuckets());
+        size_t const wanted   = roundUpToPowerOf2(expectedTuples / 3 * 4 + 1);
+        return std::min(maxSlots, std::max(MIN_SLOTS, wanted));
+    }
+
 public:
-    JoinHashTable(Settings const& settings, ArenaPtr const& arena, size_t numAttributes):
+    /**
+     * @param expectedTuples the number of tuples the caller expects to insert, if known. Only used to size the table
+     *        initially; the table grows as needed regardless.
+     */
+    JoinHashTable(Settings const& settings, ArenaPtr const& arena, size_t numAttributes, size_t expectedTuples = 0):
             _settings(settings),
             _arena(arena),
             _numAttributes(numAttributes),
             _numKeys(_settings.getNumKeys()),
             _keyComparators(_settings.getKeyComparators()),
-            _numHashBuckets(_settings.getNumHashBuckets()),
-            _buckets(_arena, _numHashBuckets, NULL),
-            _values(0),
-            _largeValueMemory(0),
-            _numHashes(0),
+            _numSlots(chooseInitialNumSlots(_settings, expectedTuples)),
+            _slotMask(_numSlots - 1),
+            _slots(_numSlots, HashTableSlot {EMPTY, 0}),
+            _oldSlots(0),
+            _oldSlotMask(0),
+            _rehashPos(0),
+            _nextInGroup(0),
+            _groupHead(0),
+            _grouped(false),
+            _rows(0),
+            _pendingKeys(0),
+            _pages(0),
+            _pageSizes(0),
+            _pageEnd(NULL),
+            _pageFree(0),
+            _rowBytes(0),
             _numGroups(0),
+            _direct(false),
+            _directMin(0),
             _hashBuf(64)
-    {}
+    {
+        _nextInGroup.reserve(expectedTuples);
+        _rows.reserve(expectedTuples);
+    }
+
+    ~JoinHashTable()
+    {
+        for(size_t i =0; i<_pages.size(); ++i)
+        {
+            _arena->recycle(_pages[i]);
+        }
+    }
+
+    JoinHashTable(JoinHashTable const&) = delete;
+    JoinHashTable& operator=(JoinHashTable const&) = delete;
 
 public:
     /**
@@ -173,18 +527,22 @@ public:
      */
     static size_t computeTupleOverhead(Attributes const& tupleAttributes)
     {
-        size_t overhead = sizeof(HashTableEntry);  //one per tuple
+        size_t overhead = sizeof(size_t) + sizeof(char const*) + 2 * sizeof(HashTableSlot);  //group link and row start per tuple, plus slot at worst-case load
         for(size_t i =0; i<tupleAttributes.size(); ++i)
         {
             AttributeDesc const& att = tupleAttributes.findattr(i);
             size_t const size = att.getSize() == 0 ? Config::getInstance()->getOption<int>(CONFIG_STRING_SIZE_ESTIMATION) : att.getSize();
-            overhead += (sizeof(Value) + (size <= sizeof(void*) ? 0 : size));
+            overhead += (2 + (size < 0xFF ? 0 : sizeof(uint32_t)) + size);
         }
         return overhead;
     }
 
+    /**
+     * Lay the keys out back to back in buf for hashing, each preceded by its missing reason if INCLUDE_NULLS.
+     * @return the number of bytes used
+     */
     template<bool INCLUDE_NULLS = false> //note: the table does not allow null entries but we can hash null values
-    static uint32_t hashKeys(vector<Value const*> const& keys, size_t const numKeys, vector<char>& buf)
+    static size_t packHashInput(vector<Value const*> const& keys, size_t const numKeys, vector<char>& buf)
     {
         size_t totalSize = 0;
         for(size_t i =0; i<numKeys; ++i)
@@ -226,12 +584,146 @@ public:
                 ch += keys[i]->size();
             }
         }
-        return murmur3_32(&buf[0], totalSize);
+        return totalSize;
+    }
+
+    template<bool INCLUDE_NULLS = false>
+    static uint32_t hashKeys(vector<Value const*> const& keys, size_t const numKeys, vector<char>& buf, uint32_t const seed = 0x5C1DB123)
+    {
+        size_t const totalSize = packHashInput<INCLUDE_NULLS>(keys, numKeys, buf);
+        return murmur3_32(&buf[0], totalSize, seed);
+    }
+
+    /**
+     * The 64-bit hash of the keys: this is the hash of the tupled arrays, used to place, sort and partition tuples, and
+     * the fingerprint of KEYS_GENERIC tables.
+     */
+    template<bool INCLUDE_NULLS = false>
+    static uint64_t hashKeys64(vector<Value const*> const& keys, size_t const numKeys, vector<char>& buf)
+    {
+        size_t const totalSize = packHashInput<INCLUDE_NULLS>(keys, numKeys, buf);
+        return murmur3_64(&buf[0], totalSize);
+    }
+
+private:
+    static void hashRows(char const* rows, size_t const len, size_t const count, uint32_t* hashes, uint32_t const seed)
+    {
+        murmur3_32Batch(rows, len, count, hashes, seed);
+    }
+
+    static void hashRows(char const* rows, size_t const len, size_t const count, uint64_t* hashes, uint32_t const seed)
+    {
+        for(size_t i =0; i<count; ++i)
+        {
+            hashes[i] = murmur3_64(rows + i * len, len, seed);
+        }
+    }
+
+    template<bool INCLUDE_NULLS>
+    static void hashOne(vector<Value const*> const& keys, size_t const numKeys, vector<char>& buf, uint32_t* hash, uint32_t const seed)
+    {
+        *hash = hashKeys<INCLUDE_NULLS>(keys, numKeys, buf, seed);
+    }
+
+    template<bool INCLUDE_NULLS>
+    static void hashOne(vector<Value const*> const& keys, size_t const numKeys, vector<char>& buf, uint64_t* hash, uint32_t const seed)
+    {
+        size_t const totalSize = packHashInput<INCLUDE_NULLS>(keys, numKeys, buf);
+        *hash = murmur3_64(&buf[0], totalSize, seed);
+    }
+
+    /**
+     * Copy the keys of a tuple into the row at ch, len bytes as hashKeysBatch lays them out, unless one of them is null
+     * or they do not add up to keySize.
+     * @return false if the keys were not copied and the tuple must be hashed on its own
+     */
+    template<bool INCLUDE_NULLS>
+    static bool packFixedKeys(vector<Value const*> const& keys, size_t const numKeys, size_t const keySize, char* ch)
+    {
+        size_t size = 0;
+        for(size_t i =0; i<numKeys; ++i)
+        {
+            size += keys[i]->size();
+        }
+        if(size != keySize || isNullTuple(keys, numKeys))
+        {
+            return false;
+        }
+        for(size_t i =0; i<numKeys; ++i)
+        {
+            if(INCLUDE_NULLS)
+            {
+                Value::reason const mc = -1;
+                memcpy(ch, &mc, sizeof(mc));
+                ch += sizeof(mc);
+            }
+            memcpy(ch, keys[i]->data(), keys[i]->size());
+            ch += keys[i]->size();
+        }
+        return true;
+    }
+
+public:
+    /**
+     * hashKeys64 of one tuple whose keys have the fixed total size keySize: the key bytes are copied into buf without
+     * sizing each one first. A tuple with a null key, or whose keys turn out to be of another size, goes to hashKeys64.
+     */
+    template<bool INCLUDE_NULLS = false>
+    static uint64_t hashFixedKeys64(vector<Value const*> const& keys, size_t const numKeys, size_t const keySize, vector<char>& buf)
+    {
+        size_t const len = keySize + (INCLUDE_NULLS ? numKeys * sizeof(Value::reason) : 0);
+        if(buf.size() < len)
+        {
+            buf.resize(len);
+        }
+        if(!packFixedKeys<INCLUDE_NULLS>(keys, numKeys, keySize, &buf[0]))
+        {
+            return hashKeys64<INCLUDE_NULLS>(keys, numKeys, buf);
+        }
+        return murmur3_64(&buf[0], len);
     }
 
-    uint32_t hashKeys(vector<Value const*> const& keys, size_t const numKeys) const
+    /**
+     * hashKeys (for uint32_t hashes) or hashKeys64 (for uint64_t) of count tuples at once, given the total size of their
+     * keys when they all have a fixed size (see Settings::getKeySize). The keys are packed into equal rows of buf and
+     * hashed in one go, with murmur3_32Batch for 32-bit hashes; a tuple with a null key, or whose keys turn out to be of
+     * another size, is hashed on its own.
+     */
+    template<bool INCLUDE_NULLS = false, typename HASH>
+    static void hashKeysBatch(vector<vector<Value const*> > const& tuples, size_t const count, size_t const numKeys, size_t const keySize,
+                              HASH* hashes, vector<char>& buf, uint32_t const seed = 0x5C1DB123)
     {
-        return hashKeys(keys, numKeys, _hashBuf);
+        size_t const len = keySize + (INCLUDE_NULLS ? numKeys * sizeof(Value::reason) : 0);
+        if(count == 0)
+        {
+            return;
+        }
+        if(buf.size() < len * count)
+        {
+            buf.resize(len * count);
+        }
+        size_t numOdd = 0;
+        for(size_t t =0; t<count; ++t)
+        {
+            if(!packFixedKeys<INCLUDE_NULLS>(tuples[t], numKeys, keySize, &buf[t * len]))
+            {
+                ++numOdd;
+            }
+        }
+        hashRows(&buf[0], len, count, hashes, seed);
+        for(size_t t =0; numOdd != 0 && t<count; ++t) //the rows are hashed, so buf is free for the odd tuples
+        {
+            size_t size = 0;
+            for(size_t i =0; i<numKeys; ++i)
+            {
+                size += tuples[t][i]->size();
+            }
+            if(size != keySize || isNullTuple(tuples[t], numKeys))
+            {
+                hashOne<INCLUDE_NULLS>(tuples[t], numKeys, buf, hashes + t, seed);
+                --numOdd;
+            }
+        }
     }
 
     //Sometimes they're vectors of pointers, sometimes pointers inside vectors; gets a little annoying
@@ -293,162 +785,795 @@ public:
     }
 
 private:
-    size_t addTuple(vector<Value const*> const& tuple)
+    static size_t packedFieldSize(Value const& datum)
     {
-        size_t idx = _values.size();
-        for(size_t i=0; i<_numAttributes; ++i)
+        if(datum.isNull())
         {
-            Value const& datum = *(tuple[i]);
-            if(datum.isLarge())
-            {
-                _largeValueMemory += datum.size();
-            }
-            _values.push_back(datum);
+            return 1;
         }
-        return idx;
+        return 2 + (datum.size() < 0xFF ? 0 : sizeof(uint32_t)) + datum.size();
     }
 
-    Value const* getTuple(size_t const idx) const
+    static void packField(char*& dst, Value const& datum)
     {
-        return &(_values[idx]);
+        *dst++ = datum.isNull() ? datum.getMissingReason() : -1;
+        if(datum.isNull())
+        {
+            return;
+        }
+        uint32_t const size = datum.size();
+        if(size < 0xFF)
+        {
+            *dst++ = static_cast<char>(size);
+        }
+        else
+        {
+            *dst++ = static_cast<char>(0xFF);
+            memcpy(dst, &size, sizeof(size));
+            dst += sizeof(size);
+        }
+        memcpy(dst, datum.data(), size);
+        dst += size;
     }
 
-public:
-    void insert(vector<Value const*> const& tuple)
+    /**
+     * Advance src past one field.
+     * @return the missing reason of the field, -1 if it is not null, in which case data and size describe its value
+     */
+    static int8_t unpackField(char const*& src, char const*& data, uint32_t& size)
+    {
+        int8_t const missingReason = *src++;
+        if(missingReason != -1)
+        {
+            return missingReason;
+        }
+        size = static_cast<uint8_t>(*src++);
+        if(size == 0xFF)
+        {
+            memcpy(&size, src, sizeof(size));
+            src += sizeof(size);
+        }
+        data = src;
+        src += size;
+        return missingReason;
+    }
+
+    static void unpackRow(char const* src, Value* tuple, size_t const numFields)
     {
-        uint32_t hash = hashKeys(tuple, _numKeys) % _numHashBuckets;
-        int newGroup = 1;
-        int newHash = 1;
-        HashTableEntry** entry = &(_buckets[hash]);
-        while( (*entry) != NULL)
+        for(size_t i =0; i<numFields; ++i)
         {
-            newHash = 0;
-            HashTableEntry** next = &((*entry)->next);
-            Value const* storedTuple = getTuple( (*entry)->idx);
-            if(keysEqual(storedTuple, tuple))
+            char const* data = NULL;
+            uint32_t size = 0;
+            int8_t const missingReason = unpackField(src, data, size);
+            if(missingReason == -1)
             {
-                newGroup = 0;
-                break;
+                tuple[i].setData(data, size);
             }
-            else if (!keysLess(storedTuple, tuple))
+            else
             {
-                break;
+                tuple[i].setNull(missingReason);
             }
-            entry = next;
         }
-        _numGroups += newGroup;
-        _numHashes += newHash;
-        size_t idx = addTuple(tuple);
-        HashTableEntry* newEntry = ((HashTableEntry*)_arena->allocate(sizeof(HashTableEntry)));
-        *newEntry = HashTableEntry(idx,*entry);
-        *entry = newEntry;
     }
 
-    bool contains(std::vector<Value const*> const& keys, uint32_t& hash) const
+    char* allocateRow(size_t const size)
+    {
+        if(_pageFree < size)
+        {
+            size_t const pageSize = std::max(size, std::min(ROW_PAGE_SIZE, std::max(MIN_ROW_PAGE_SIZE, _rowBytes)));
+            _pages.push_back(static_cast<char*>(_arena->allocate(pageSize)));
+            _pageSizes.push_back(pageSize);
+            _pageEnd  = _pages.back();
+            _pageFree = pageSize;
+        }
+        char* row = _pageEnd;
+        _pageEnd  += size;
+        _pageFree -= size;
+        _rowBytes += size;
+        return row;
+    }
+
+    size_t addTuple(vector<Value const*> const& tuple)
+    {
+        if(_grouped)
+        {
+            ungroupRows();
+        }
+        size_t row = _rows.size();
+        size_t size = 0;
+        for(size_t i=0; i<_numAttributes; ++i)
+        {
+            size += packedFieldSize(*(tuple[i]));
+        }
+        char* dst = allocateRow(size);
+        _rows.push_back(dst);
+        for(size_t i=0; i<_numAttributes; ++i)
+        {
+            packField(dst, *(tuple[i]));
+        }
+        _nextInGroup.push_back(EMPTY);
+        return row;
+    }
+
+    /**
+     * Compare the keys packed at the start of a row to the given ones, with the same byte semantics as keysEqual.
+     */
+    bool rowKeysEqual(size_t const row, vector<Value const*> const& keys) const
     {
-        hash = hashKeys(keys, _numKeys) % _numHashBuckets;
-        HashTableEntry const* bucket = _buckets[hash];
-        while(bucket != NULL)
+        char const* src = _rows[row];
+        for(size_t i =0; i<_numKeys; ++i)
         {
-            if(keysEqual(getTuple(bucket->idx), keys))
+            char const* data = NULL;
+            uint32_t size = 0;
+            Value const& key = *(keys[i]);
+            if(unpackField(src, data, size) != -1)
             {
-                return true;
+                size = 0;
             }
-            else if(! keysLess(getTuple(bucket->idx), keys))
+            if(size != key.size() || memcmp(data, key.data(), size) != 0)
             {
                 return false;
             }
-            bucket = bucket->next;
         }
-        return false;
+        return true;
+    }
+
+    size_t keysSize(char const* row) const
+    {
+        return packedSize(row, _numKeys);
+    }
+
+    static size_t packedSize(char const* row, size_t const numFields)
+    {
+        char const* src = row;
+        for(size_t i =0; i<numFields; ++i)
+        {
+            char const* data = NULL;
+            uint32_t size = 0;
+            unpackField(src, data, size);
+        }
+        return src - row;
     }
 
     /**
-     * @return the total amount of bytes used by the structure
+     * Compare the keys of two stored rows. Keys are never null in the table, so their packed bytes are equal exactly
+     * when the keys are.
      */
-    size_t usedBytes() const
+    bool rowKeysEqual(size_t const row, size_t const otherRow) const
+    {
+        size_t const size = keysSize(_rows[row]);
+        return size == keysSize(_rows[otherRow]) && memcmp(_rows[row], _rows[otherRow], size) == 0;
+    }
+
+    /**
+     * @return the row after row in its group, or EMPTY
+     */
+    size_t nextInGroup(size_t const row) const
     {
-        if(_largeValueMemory < 0)
+        if(_grouped)
         {
-            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION)<<"inconsistent state size overflow";
+            return row + 1 < _rows.size() && _groupHead[row + 1] == _groupHead[row] ? row + 1 : EMPTY;
         }
-        return _arena->allocated() + _values.size() * sizeof(Value)  + _largeValueMemory;
+        return _nextInGroup[row];
     }
 
-    class const_iterator
+    /**
+     * @return the row that holds the keys of row
+     */
+    size_t keysRow(size_t const row) const
     {
-    private:
-        JoinHashTable const* _table;
-        HashTableEntry const* _mark;
-        uint32_t _markHash;
-        uint32_t _currHash;
-        HashTableEntry const* _entry;
+        return _grouped ? _groupHead[row] : row;
+    }
 
-    public:
-        const_iterator(JoinHashTable const* table):
-            _table(table),
-            _mark(NULL)
+    void unpackTuple(size_t const row, Value* tuple) const
+    {
+        size_t const head = keysRow(row);
+        if(head == row)
         {
-            restart();
+            unpackRow(_rows[row], tuple, _numAttributes);
+            return;
         }
+        unpackRow(_rows[head], tuple, _numKeys);
+        unpackRow(_rows[row], tuple + _numKeys, _numAttributes - _numKeys);
+    }
 
-        void restart()
+    /**
+     * Write rows, copied back to back into image with each one ending at rowEnds, over the pages of the table in order,
+     * as row 0, 1 and so on. Pages are only allocated once the ones the table has are full. The arena does not give
+     * recycled pages back until it is reset, so rewriting the rows in place keeps the footprint from growing.
+     */
+    void relayRows(std::vector<char> const& image, std::vector<size_t> const& rowEnds)
+    {
+        size_t const numPages = _pages.size();
+        size_t page = 0;
+        _pageEnd  = numPages ? _pages[0] : NULL;
+        _pageFree = numPages ? _pageSizes[0] : 0;
+        _rowBytes = 0;
+        _rows.resize(rowEnds.size());
+        size_t start = 0;
+        for(size_t row =0; row<rowEnds.size(); ++row)
         {
-            _currHash = 0;
-            do
+            size_t const size = rowEnds[row] - start;
+            while(_pageFree < size && page + 1 < numPages)
             {
-                _entry = _table->_buckets[_currHash];
-                if(_entry != NULL)
-                {
-                    break;
-                }
-                ++_currHash;
-            } while(_currHash < _table->_numHashBuckets);
+                ++page;
+                _pageEnd  = _pages[page];
+                _pageFree = _pageSizes[page];
+            }
+            char* dst = allocateRow(size);
+            memcpy(dst, &(image[start]), size);
+            _rows[row] = dst;
+            start = rowEnds[row];
         }
+    }
 
-        bool end() const
+    /**
+     * Rewrite the rows of an indexed table grouped, if there are enough rows per group; see the class comment. The
+     * rows of a group keep their order. They are copied out to the heap first and then laid back over the old pages,
+     * so the table is left ungrouped if that copy would not fit under the memory limit.
+     */
+    void groupRows()
+    {
+        size_t const numRows = _rows.size();
+        if(_grouped || _numGroups == 0 || numRows < GROUP_MIN_ROWS_PER_KEY * _numGroups)
         {
-            return _currHash >= _table->_numHashBuckets;
+            return;
         }
-
-        void nextAtHash()
+        if(_settings.getMemoryLimit() && usedBytes() + _rowBytes > _settings.getMemoryLimit())
         {
-            if (end())
+            LOG4CXX_DEBUG(logger, "EJ not grouping "<<numRows<<" rows, copying row bytes "<<_rowBytes<<" would exceed the memory limit");
+            return;
+        }
+        std::vector<char> image;
+        std::vector<size_t> rowEnds;
+        image.reserve(_rowBytes);
+        rowEnds.reserve(numRows);
+        _groupHead.reserve(numRows);
+        size_t const numPayloadFields = _numAttributes - _numKeys;
+        for(size_t pos =0; pos<getTotalNumSlots(); ++pos)
+        {
+            HashTableSlot& slot = pos < _numSlots ? _slots[pos] : _oldSlots[pos - _numSlots];
+            if(slot.row == EMPTY || slot.row == MOVED)
             {
-                throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "iterating past end";
+                continue;
             }
-            _entry = _entry->next;
-            if ( _entry == NULL )
+            size_t const keysBytes = keysSize(_rows[slot.row]);
+            size_t const head = rowEnds.size();
+            image.insert(image.end(), _rows[slot.row], _rows[slot.row] + keysBytes);
+            for(size_t row = slot.row; row != EMPTY; row = _nextInGroup[row])
             {
-                _currHash = _table->_numHashBuckets; //invalidate
+                char const* payload = _rows[row] + keysBytes;
+                image.insert(image.end(), payload, payload + packedSize(payload, numPayloadFields));
+                rowEnds.push_back(image.size());
+                _groupHead.push_back(head);
             }
+            slot.row = head;
         }
+        relayRows(image, rowEnds);
+        std::vector<size_t>().swap(_nextInGroup);
+        _grouped = true;
+        LOG4CXX_DEBUG(logger, "EJ grouped "<<numRows<<" rows under "<<_numGroups<<" keys, row bytes "<<_rowBytes);
+    }
 
-        void next()
+    /**
+     * Undo groupRows, so that rows can be added: every row but the first of each group gets its keys back, and the
+     * groups are linked through _nextInGroup again.
+     */
+    void ungroupRows()
+    {
+        size_t const numRows = _rows.size();
+        size_t const numPayloadFields = _numAttributes - _numKeys;
+        std::vector<char> image;
+        std::vector<size_t> rowEnds;
+        image.reserve(_rowBytes);
+        rowEnds.reserve(numRows);
+        _nextInGroup.assign(numRows, EMPTY);
+        for(size_t row =0; row<numRows; ++row)
+        {
+            size_t const head = _groupHead[row];
+            size_t const keysBytes = keysSize(_rows[head]);
+            char const* payload = row == head ? _rows[row] + keysBytes : _rows[row];
+            image.insert(image.end(), _rows[head], _rows[head] + keysBytes);
+            image.insert(image.end(), payload, payload + packedSize(payload, numPayloadFields));
+            rowEnds.push_back(image.size());
+            if(row + 1 < numRows && _groupHead[row + 1] == head)
+            {
+                _nextInGroup[row] = row + 1;
+            }
+        }
+        relayRows(image, rowEnds);
+        std::vector<size_t>().swap(_groupHead);
+        _grouped = false;
+    }
+
+    Key makeKey(vector<Value const*> const& keys, vector<char>& hashBuf) const
+    {
+        return Traits::PACKED ? packKeys<Key>(keys, _numKeys) : hashKeys64(keys, _numKeys, hashBuf);
+    }
+
+    Key makeKey(vector<Value const*> const& keys) const
+    {
+        return makeKey(keys, _hashBuf);
+    }
+
+    /**
+     * Find the slot holding the given keys, or the empty slot where they would go. The keys are either Values or the
+     * row number of a stored tuple.
+     */
+    template <typename KEYS_TYPE>
+    size_t probe(std::vector<HashTableSlot> const& slots, size_t const slotMask, KEYS_TYPE const& keys, Key const key) const
+    {
+        size_t pos = Traits::hash(key) & slotMask;
+        while(true)
+        {
+            HashTableSlot const& slot = slots[pos];
+            if(slot.row == EMPTY || (slot.row != MOVED && slot.key == key && (Traits::PACKED || rowKeysEqual(slot.row, keys))))
+            {
+                return pos;
+            }
+            pos = (pos + 1) & slotMask;
+        }
+    }
+
+    /**
+     * @return the position of the group with the given keys, EMPTY if there is none. Positions at or above _numSlots
+     * refer to _oldSlots.
+     */
+    size_t findGroup(vector<Value const*> const& keys, Key const key) const
+    {
+        if(_direct)
+        {
+            Key const pos = key - _directMin;
+            return pos < _numSlots && _slots[static_cast<size_t>(pos)].row != EMPTY ? static_cast<size_t>(pos) : EMPTY;
+        }
+        if(_oldSlots.size())
+        {
+            size_t pos = probe(_oldSlots, _oldSlotMask, keys, key);
+            if(_oldSlots[pos].row != EMPTY)
+            {
+                return _numSlots + pos;
+            }
+        }
+        size_t pos = probe(_slots, _slotMask, keys, key);
+        return _slots[pos].row == EMPTY ? EMPTY : pos;
+    }
+
+    /**
+     * Start loading the slot where the search for key begins.
+     */
+    void prefetchSlot(Key const key) const
+    {
+        if(_direct)
+        {
+            Key const pos = key - _directMin;
+            if(pos < _numSlots)
+            {
+                __builtin_prefetch(&(_slots[static_cast<size_t>(pos)]));
+            }
+            return;
+        }
+        __builtin_prefetch(&(_slots[Traits::hash(key) & _slotMask]));
+    }
+
+    size_t getTotalNumSlots() const
+    {
+        return _numSlots + _oldSlots.size();
+    }
+
+    HashTableSlot const& getSlot(size_t const pos) const
+    {
+        return pos < _numSlots ? _slots[pos] : _oldSlots[pos - _numSlots];
+    }
+
+    /**
+     * Place a group that is known not to be in the new array yet.
+     */
+    void placeGroup(HashTableSlot const& group)
+    {
+        size_t pos = Traits::hash(group.key) & _slotMask;
+        while(_slots[pos].row != EMPTY)
+        {
+            pos = (pos + 1) & _slotMask;
+        }
+        _slots[pos] = group;
+    }
+
+    void startRehash()
+    {
+        _oldSlots.swap(_slots);
+        _oldSlotMask = _slotMask;
+        _rehashPos = 0;
+        _numSlots = _numSlots * 2;
+        _slotMask = _numSlots - 1;
+        _slots.assign(_numSlots, HashTableSlot {EMPTY, 0});
+    }
+
+    void continueRehash()
+    {
+        size_t const stop = std::min(_rehashPos + REHASH_STEP, _oldSlots.size());
+        for(; _rehashPos < stop; ++_rehashPos)
+        {
+            HashTableSlot& slot = _oldSlots[_rehashPos];
+            if(slot.row != EMPTY && slot.row != MOVED)
+            {
+                placeGroup(slot);
+                slot.row = MOVED;
+            }
+        }
+        if(_rehashPos == _oldSlots.size())
+        {
+            std::vector<HashTableSlot>().swap(_oldSlots);
+            _rehashPos = 0;
+        }
+    }
+
+    /**
+     * Add row to the group of its key, at the slot given by the key in a direct index.
+     */
+    void indexRowDirect(size_t const row, Key const key)
+    {
+        HashTableSlot& slot = _slots[static_cast<size_t>(key - _directMin)];
+        if(slot.row == EMPTY)
+        {
+            ++_numGroups;
+            slot.key = key;
+        }
+        else
+        {
+            _nextInGroup[row] = slot.row;
+        }
+        slot.row = row;
+    }
+
+    /**
+     * Index the pending keys directly if LAYOUT allows it, nothing has been indexed yet and the keys are dense enough.
+     * @return false if the table should be hashed instead
+     */
+    bool buildDirectIndex()
+    {
+        size_t const numPending = _pendingKeys.size();
+        if(LAYOUT != KEYS_PACKED_64 || _numGroups != 0 || !_oldSlots.empty() || numPending == 0)
+        {
+            return false;
+        }
+        //a lone 8-byte key, such as an int64 or a dimension, fills the whole Key and is ordered as signed
+        bool const isSigned = _settings.getKeySize() == sizeof(int64_t);
+        Key lo = _pendingKeys[0];
+        Key hi = lo;
+        for(size_t i =1; i<numPending; ++i)
+        {
+            Key const key = _pendingKeys[i];
+            if(isSigned ? static_cast<int64_t>(key) < static_cast<int64_t>(lo) : key < lo)
+            {
+                lo = key;
+            }
+            if(isSigned ? static_cast<int64_t>(key) > static_cast<int64_t>(hi) : key > hi)
+            {
+                hi = key;
+            }
+        }
+        Key const spread = hi - lo;
+        if(spread / DIRECT_MAX_SPREAD >= numPending)
+        {
+            return false;
+        }
+        LOG4CXX_DEBUG(logger, "EJ direct index over "<<static_cast<size_t>(spread) + 1<<" keys for "<<numPending<<" rows");
+        _direct = true;
+        _directMin = lo;
+        _numSlots = static_cast<size_t>(spread) + 1;
+        _slotMask = 0;
+        _slots.assign(_numSlots, HashTableSlot {EMPTY, 0});
+        size_t row = _rows.size() - numPending;
+        for(size_t i =0; i<numPending; ++i, ++row)
+        {
+            indexRowDirect(row, _pendingKeys[i]);
+        }
+        return true;
+    }
+
+    /**
+     * Move the groups of a direct index into hashed slots, so that keys outside of its range can be added.
+     */
+    void dropDirectIndex()
+    {
+        std::vector<HashTableSlot> direct;
+        direct.swap(_slots);
+        _direct = false;
+        _numSlots = std::max(MIN_SLOTS, roundUpToPowerOf2(_numGroups * 2 + 1));
+        _slotMask = _numSlots - 1;
+        _slots.assign(_numSlots, HashTableSlot {EMPTY, 0});
+        for(size_t i =0; i<direct.size(); ++i)
+        {
+            if(direct[i].row != EMPTY)
+            {
+                placeGroup(direct[i]);
+            }
+        }
+    }
+
+    void indexRow(size_t const row, Key const key)
+    {
+        if(_direct)
+        {
+            if(key - _directMin < _numSlots)
+            {
+                indexRowDirect(row, key);
+                return;
+            }
+            dropDirectIndex();
+        }
+        if(_oldSlots.empty() && (_numGroups + 1) * 4 > _numSlots * 3) //keep the load factor at or below 3/4
+        {
+            startRehash();
+        }
+        if(_oldSlots.size())
+        {
+            size_t pos = probe(_oldSlots, _oldSlotMask, row, key);
+            if(_oldSlots[pos].row != EMPTY) //not migrated yet, move it now so the group lives in one place
+            {
+                placeGroup(_oldSlots[pos]);
+                _oldSlots[pos].row = MOVED;
+            }
+            continueRehash();
+        }
+        HashTableSlot& slot = _slots[probe(_slots, _slotMask, row, key)];
+        if(slot.row == EMPTY)
+        {
+            ++_numGroups;
+            slot.key = key;
+        }
+        else
+        {
+            _nextInGroup[row] = slot.row;
+        }
+        slot.row = row;
+    }
+
+public:
+    void insert(vector<Value const*> const& tuple)
+    {
+        Key const key = makeKey(tuple);
+        indexRow(addTuple(tuple), key);
+    }
+
+    /**
+     * Store a tuple without making it findable; buildIndex() must be called before any lookups. Lets the caller spread
+     * tuples over many tables first and then index one table at a time, while it is in cache.
+     */
+    void append(vector<Value const*> const& tuple)
+    {
+        Key const key = makeKey(tuple);
+        addTuple(tuple);
+        _pendingKeys.push_back(key);
+    }
+
+    /**
+     * Take over all tuples of another table as if they had been append()ed here, in the same order; other is left
+     * empty. It must not have been indexed and must allocate from the same arena.
+     */
+    void adopt(JoinHashTable& other)
+    {
+        if(other._numGroups != 0 || other._pendingKeys.size() != other._rows.size() || other._arena != _arena)
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "internal inconsistency";
+        }
+        if(_grouped)
+        {
+            ungroupRows();
+        }
+        _rows.insert(_rows.end(), other._rows.begin(), other._rows.end());
+        _pendingKeys.insert(_pendingKeys.end(), other._pendingKeys.begin(), other._pendingKeys.end());
+        _nextInGroup.resize(_nextInGroup.size() + other._nextInGroup.size(), EMPTY);
+        _pages.insert(_pages.end(), other._pages.begin(), other._pages.end());
+        _pageSizes.insert(_pageSizes.end(), other._pageSizes.begin(), other._pageSizes.end());
+        _rowBytes += other._rowBytes;
+        other._rows.clear();
+        other._pendingKeys.clear();
+        other._nextInGroup.clear();
+        other._pages.clear();
+        other._pageSizes.clear();
+        other._pageEnd  = NULL;
+        other._pageFree = 0;
+        other._rowBytes = 0;
+    }
+
+    /**
+     * @return the size of the buffer serialize() writes
+     */
+    size_t serializedSize() const
+    {
+        return 2 * sizeof(size_t) + _rows.size() * sizeof(Key) + _rowBytes;
+    }
+
+    /**
+     * Write the rows and keys of a table that has not been indexed to dst, for appendSerialized on another instance:
+     * the number of rows, the number of row bytes, the keys, then the rows back to back.
+     */
+    void serialize(char* dst) const
+    {
+        if(_numGroups != 0 || _pendingKeys.size() != _rows.size())
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "internal inconsistency";
+        }
+        size_t const numRows = _rows.size();
+        memcpy(dst, &numRows, sizeof(size_t));
+        dst += sizeof(size_t);
+        memcpy(dst, &_rowBytes, sizeof(size_t));
+        dst += sizeof(size_t);
+        if(numRows != 0)
+        {
+            memcpy(dst, &(_pendingKeys[0]), numRows * sizeof(Key));
+            dst += numRows * sizeof(Key);
+        }
+        for(size_t i =0; i<numRows; ++i)
+        {
+            size_t const size = packedSize(_rows[i], _numAttributes);
+            memcpy(dst, _rows[i], size);
+            dst += size;
+        }
+    }
+
+    /**
+     * Add the rows written by serialize() on a table with the same settings, as if they had been append()ed in the
+     * same order. The rows are copied into one page with their keys, so nothing is hashed again.
+     */
+    void appendSerialized(char const* src)
+    {
+        size_t numRows, rowBytes;
+        memcpy(&numRows, src, sizeof(size_t));
+        src += sizeof(size_t);
+        memcpy(&rowBytes, src, sizeof(size_t));
+        src += sizeof(size_t);
+        if(numRows == 0)
+        {
+            return;
+        }
+        if(_grouped)
+        {
+            ungroupRows();
+        }
+        size_t const firstKey = _pendingKeys.size();
+        _pendingKeys.resize(firstKey + numRows);
+        memcpy(&(_pendingKeys[firstKey]), src, numRows * sizeof(Key));
+        src += numRows * sizeof(Key);
+        char* dst = allocateRow(rowBytes);
+        memcpy(dst, src, rowBytes);
+        _rows.reserve(_rows.size() + numRows);
+        for(size_t i =0; i<numRows; ++i)
+        {
+            _rows.push_back(dst);
+            dst += packedSize(dst, _numAttributes);
+        }
+        _nextInGroup.resize(_nextInGroup.size() + numRows, EMPTY);
+    }
+
+    void buildIndex()
+    {
+        if(buildDirectIndex())
+        {
+            std::vector<Key>().swap(_pendingKeys);
+            groupRows();
+            return;
+        }
+        if(_numGroups == 0 && _oldSlots.empty() && chooseInitialNumSlots(_settings, _pendingKeys.size()) > _numSlots)
+        {
+            _numSlots = chooseInitialNumSlots(_settings, _pendingKeys.size());
+            _slotMask = _numSlots - 1;
+            _slots.assign(_numSlots, HashTableSlot {EMPTY, 0});
+        }
+        size_t row = _rows.size() - _pendingKeys.size();
+        for(size_t i =0; i<_pendingKeys.size(); ++i, ++row)
+        {
+            indexRow(row, _pendingKeys[i]);
+        }
+        std::vector<Key>().swap(_pendingKeys);
+        groupRows();
+    }
+
+    bool contains(std::vector<Value const*> const& keys, uint64_t& hash) const
+    {
+        Key const key = makeKey(keys);
+        hash = Traits::hash(key);
+        return findGroup(keys, key) != EMPTY;
+    }
+
+    /**
+     * @return the total amount of bytes used by the structure
+     */
+    size_t usedBytes() const
+    {
+        return _arena->allocated() + (_rows.capacity() + _pages.capacity()) * sizeof(char*) + (_nextInGroup.capacity() + _groupHead.capacity()) * sizeof(size_t) +
+               (_slots.capacity() + _oldSlots.capacity()) * sizeof(HashTableSlot) + _pendingKeys.capacity() * sizeof(Key);
+    }
+
+    class const_iterator
+    {
+    private:
+        JoinHashTable const* _table;
+        size_t _currSlot;
+        size_t _row;
+        mutable vector<Value> _tuple;       //the current row, unpacked on demand
+        mutable size_t _unpackedRow;
+        vector<char> _hashBuf;              //our own, so that several iterators can probe the same table concurrently
+        vector<Key> _batchKeys;
+        vector<size_t> _batchSlots;
+        vector<uint64_t> _batchHashes;
+
+        static bool isGroup(HashTableSlot const& slot)
+        {
+            return slot.row != EMPTY && slot.row != MOVED;
+        }
+
+    public:
+        const_iterator(JoinHashTable const* table):
+            _table(table),
+            _tuple(table->_numAttributes),
+            _unpackedRow(EMPTY),
+            _hashBuf(64)
+        {
+            restart();
+        }
+
+        void restart()
+        {
+            _currSlot = 0;
+            while(!end() && !isGroup(_table->getSlot(_currSlot)))
+            {
+                ++_currSlot;
+            }
+            if(!end())
+            {
+                _row = _table->getSlot(_currSlot).row;
+            }
+        }
+
+        bool end() const
+        {
+            return _currSlot >= _table->getTotalNumSlots();
+        }
+
+        void nextAtHash()
         {
             if (end())
             {
                 throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "iterating past end";
             }
-            _entry = _entry->next;
-            while ( _entry == NULL )
+            _row = _table->nextInGroup(_row);
+            if ( _row == EMPTY )
             {
-                ++(_currHash);
+                _currSlot = _table->getTotalNumSlots(); //invalidate
+            }
+        }
+
+        void next()
+        {
+            if (end())
+            {
+                throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "iterating past end";
+            }
+            _row = _table->nextInGroup(_row);
+            while ( _row == EMPTY )
+            {
+                ++(_currSlot);
                 if(end())
                 {
                     return;
                 }
-                _entry = _table->_buckets[_currHash];
+                HashTableSlot const& slot = _table->getSlot(_currSlot);
+                if(isGroup(slot))
+                {
+                    _row = slot.row;
+                }
             }
         }
 
-        uint32_t getCurrentHash() const
+        uint64_t getCurrentHash() const
         {
             if (end())
             {
                 throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "access past end";
             }
-            return _currHash;
+            return Traits::hash(_table->getSlot(_currSlot).key);
         }
 
         Value const* getTuple() const
@@ -457,28 +1582,92 @@ public:
             {
                 throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "access past end";
             }
-            return &(_table->_values[_entry->idx]);
+            if(_unpackedRow != _row)
+            {
+                _table->unpackTuple(_row, &(_tuple[0]));
+                _unpackedRow = _row;
+            }
+            return &(_tuple[0]);
         }
 
         bool find(vector<Value const*> const& keys)
         {
-            _currHash = _table->hashKeys(keys, _table->_numKeys) % _table->_numHashBuckets;
-            _entry = _table->_buckets[_currHash];
-            while(_entry != NULL && ! _table->keysEqual(getTuple(), keys))
+            _currSlot = _table->findGroup(keys, _table->makeKey(keys, _hashBuf));
+            if(_currSlot == EMPTY)
+            {
+                _currSlot = _table->getTotalNumSlots(); //invalidate
+                return false;
+            }
+            _row = _table->getSlot(_currSlot).row;
+            return true;
+        }
+
+        /**
+         * Look up a batch of tuples, none with null keys. All keys are made and their slots prefetched first, then the
+         * groups are found and their first rows prefetched, and only then are the groups walked; so the cache misses
+         * of the batch overlap instead of stalling one after another. Fills matches with a (probe index, row) pair for
+         * each stored tuple that has the keys of a probe, in probe order; see getRowTuple. Invalidates the iterator.
+         */
+        void findBatch(vector<vector<Value const*> > const& probes, size_t const numProbes, vector<std::pair<size_t, size_t> >& matches)
+        {
+            matches.clear();
+            _currSlot = _table->getTotalNumSlots(); //invalidate
+            if(numProbes == 0)
+            {
+                return;
+            }
+            _batchKeys.resize(numProbes);
+            _batchSlots.resize(numProbes);
+            if(!Traits::PACKED && _table->_settings.getKeySize() != 0) //hash them all in one go
             {
-                if(!_table->keysLess(getTuple(), keys))
+                _batchHashes.resize(numProbes);
+                hashKeysBatch(probes, numProbes, _table->_numKeys, _table->_settings.getKeySize(), &(_batchHashes[0]), _hashBuf);
+                for(size_t i =0; i<numProbes; ++i)
                 {
-                    _entry = NULL;
-                    break;
+                    _batchKeys[i] = _batchHashes[i];
+                    _table->prefetchSlot(_batchKeys[i]);
                 }
-                _entry = _entry->next;
             }
-            if(_entry == NULL)
+            else
             {
-                _currHash = _table->_numHashBuckets; //invalidate
-                return false;
+                for(size_t i =0; i<numProbes; ++i)
+                {
+                    _batchKeys[i] = _table->makeKey(probes[i], _hashBuf);
+                    _table->prefetchSlot(_batchKeys[i]);
+                }
+            }
+            for(size_t i =0; i<numProbes; ++i)
+            {
+                _batchSlots[i] = _table->findGroup(probes[i], _batchKeys[i]);
+                if(_batchSlots[i] != EMPTY)
+                {
+                    __builtin_prefetch(_table->_rows[_table->getSlot(_batchSlots[i]).row]);
+                }
+            }
+            for(size_t i =0; i<numProbes; ++i)
+            {
+                if(_batchSlots[i] == EMPTY)
+                {
+                    continue;
+                }
+                for(size_t row = _table->getSlot(_batchSlots[i]).row; row != EMPTY; row = _table->nextInGroup(row))
+                {
+                    matches.push_back(std::make_pair(i, row));
+                }
             }
-            return true;
+        }
+
+        /**
+         * @return the stored tuple of a row returned by findBatch; valid until the next call
+         */
+        Value const* getRowTuple(size_t const row) const
+        {
+            if(_unpackedRow != row)
+            {
+                _table->unpackTuple(row, &(_tuple[0]));
+                _unpackedRow = row;
+            }
+            return &(_tuple[0]);
         }
 
         bool atKeys(vector<Value const*> const& keys)
@@ -487,7 +1676,7 @@ public:
             {
                 throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "access past end";
             }
-            return _table->keysEqual(getTuple(), keys);
+            return _table->rowKeysEqual(_table->keysRow(_row), keys);
         }
     };
 
@@ -496,9 +1685,96 @@ public:
         return const_iterator(this);
     }
 
+    ArenaPtr const& getArena() const
+    {
+        return _arena;
+    }
+
+    size_t getNumTuples() const
+    {
+        return _rows.size();
+    }
+
+    void logStuff()
+    {
+        LOG4CXX_DEBUG(logger, "RJN layout "<<LAYOUT<<" direct "<<_direct<<" slots "<<getTotalNumSlots()<<" groups "<<_numGroups<<" grouped "<<_grouped<<" rows "<<_rows.size()<<" row_bytes "<<_rowBytes<<" total "<<usedBytes());
+    }
+};
+
+/**
+ * A hash table split on the tuple hash into partitions that are each small enough to stay in cache while they are
+ * built or probed. Tuples are first appended to their partition without indexing; buildIndex() then indexes the
+ * partitions one after another. The partition is taken from a remix of the hash, so it is independent of the high
+ * bits that picked the instance and of the low bits each partition uses for its slots.
+ */
+template <KeyLayout LAYOUT = KEYS_GENERIC>
+class PartitionedJoinHashTable
+{
+private:
+    size_t const                                 _numPartitions;   //always a power of 2
+    vector<shared_ptr<JoinHashTable<LAYOUT> > >  _partitions;
+
+    static size_t chooseNumPartitions(size_t const tableSize)
+    {
+        size_t result = 1;
+        while(result < MAX_RADIX_PARTITIONS && result * RADIX_PARTITION_SIZE < tableSize)
+        {
+            result <<= 1;
+        }
+        return result;
+    }
+
+public:
+    /**
+     * @param tableSize the expected footprint of the whole table, as per computeTupleOverhead
+     * @param expectedTuples the expected number of tuples in the whole table, if known
+     */
+    PartitionedJoinHashTable(Settings const& settings, ArenaPtr const& arena, size_t numAttributes, size_t tableSize, size_t expectedTuples = 0):
+        _numPartitions(chooseNumPartitions(tableSize)),
+        _partitions(_numPartitions)
+    {
+        for(size_t i =0; i<_numPartitions; ++i)
+        {
+            _partitions[i].reset(new JoinHashTable<LAYOUT>(settings, arena, numAttributes, expectedTuples / _numPartitions));
+        }
+    }
+
+    size_t getNumPartitions() const
+    {
+        return _numPartitions;
+    }
+
+    size_t partitionOf(uint64_t const hash) const
+    {
+        return fmix(hash) & (_numPartitions - 1);
+    }
+
+    void append(vector<Value const*> const& tuple, uint64_t const hash)
+    {
+        _partitions[partitionOf(hash)]->append(tuple);
+    }
+
+    void buildIndex()
+    {
+        for(size_t i =0; i<_numPartitions; ++i)
+        {
+            _partitions[i]->buildIndex();
+        }
+    }
+
+    JoinHashTable<LAYOUT> const& getPartition(size_t const partition) const
+    {
+        return *(_partitions[partition]);
+    }
+
     void logStuff()
     {
-        LOG4CXX_DEBUG(logger, "RJN hashes "<<_numHashes<<" groups "<<_numGroups<<" large_vals "<<_largeValueMemory<<" total "<<usedBytes());
+        size_t rows = 0;
+        for(size_t i =0; i<_numPartitions; ++i)
+        {
+            rows += _partitions[i]->getNumTuples();
+        }
+        LOG4CXX_DEBUG(logger, "RJN partitions "<<_numPartitions<<" rows "<<rows);
     }
 };
 
@@ -118,10 +118,21 @@ public:
             { KW_ALGORITHM, RE(PP(PLACEHOLDER_CONSTANT, TID_STRING)) },
             { KW_KEEP_DIMS, RE(PP(PLACEHOLDER_CONSTANT, TID_BOOL)) },
             { KW_BLOOM_FILT_SZ, RE(PP(PLACEHOLDER_CONSTANT, TID_INT64)) },
+            { KW_BLOOM_FILT_HASHES, RE(PP(PLACEHOLDER_CONSTANT, TID_INT64)) },
+            { KW_BLOOM_FILT_FPR, RE(PP(PLACEHOLDER_CONSTANT, TID_DOUBLE)) },
+            { KW_THREADS, RE(PP(PLACEHOLDER_CONSTANT, TID_INT64)) },
+            { KW_HYBRID_HASH, RE(PP(PLACEHOLDER_CONSTANT, TID_BOOL)) },
+            { KW_MEMORY_LIMIT, RE(PP(PLACEHOLDER_CONSTANT, TID_INT64)) },
+            { KW_DICTIONARY_KEYS, RE(PP(PLACEHOLDER_CONSTANT, TID_BOOL)) },
+            { KW_BROADCAST_TABLE, RE(PP(PLACEHOLDER_CONSTANT, TID_BOOL)) },
+            { KW_CACHE_TABLE, RE(PP(PLACEHOLDER_CONSTANT, TID_BOOL)) },
+            { KW_TABLE_CACHE_SIZE, RE(PP(PLACEHOLDER_CONSTANT, TID_INT64)) },
 //            { KW_FILTER, RE(PP(PLACEHOLDER_EXPRESSION, TID_BOOL)) },
             { KW_FILTER, RE(PP(PLACEHOLDER_CONSTANT, TID_STRING)) },
             { KW_LEFT_OUTER, RE(PP(PLACEHOLDER_EXPRESSION, TID_BOOL)) },
             { KW_RIGHT_OUTER, RE(PP(PLACEHOLDER_EXPRESSION, TID_BOOL)) },
+            { KW_SEMI, RE(PP(PLACEHOLDER_CONSTANT, TID_BOOL)) },
+            { KW_ANTI, RE(PP(PLACEHOLDER_CONSTANT, TID_BOOL)) },
             { KW_OUT_NAMES, RE(RE::OR, {
                                RE(PP(PLACEHOLDER_ATTRIBUTE_NAME).setMustExist(false)),
                                RE(RE::GROUP, {
@@ -24,12 +24,17 @@
 */
 
 #define LEGACY_API
+#include <thread>
+#include <exception>
+#include <atomic>
 #include <query/PhysicalOperator.h>
 #include <array/SortArray.h>
 #include <array/ArrayDesc.h>
 
 #include "ArrayIO.h"
 #include "JoinHashTable.h"
+#include "TableCache.h"
+#include "Collectives.h"
 
 namespace scidb
 {
@@ -73,10 +78,14 @@ public:
         return context.getArrayDistribution()->getDistType();
     }
 
+    /**
+     * @return the estimated hash table footprint of the local part of input; the number of cells is also returned
+     * through cellCount, if provided
+     */
     template<Handedness WHICH>
-    size_t computeArrayOverhead(shared_ptr<Array> &input, shared_ptr<Query>& query, Settings const& settings)
+    size_t computeArrayOverhead(shared_ptr<Array> &input, shared_ptr<Query>& query, Settings const& settings, size_t* cellCount = NULL)
     {
-        size_t tupleOverhead = JoinHashTable::computeTupleOverhead(makeTupledSchema<WHICH> (settings, query).getAttributes(true));
+        size_t tupleOverhead = JoinHashTable<>::computeTupleOverhead(makeTupledSchema<WHICH> (settings, query).getAttributes(true));
         size_t totalCount = 0;
         const auto &ebmAttr = input->getArrayDesc().getEmptyBitmapAttribute();
         shared_ptr<ConstArrayIterator> aiter(input->getConstIterator(*ebmAttr));
@@ -85,62 +94,28 @@ public:
             totalCount += aiter->getChunk().count();
             ++(*aiter);
         }
-        return totalCount * tupleOverhead;
-    }
-
-    template<Handedness WHICH>
-    size_t globalComputeArrayOverhead(shared_ptr<Array> &input, shared_ptr<Query>& query, Settings const& settings)
-    {
-        size_t overhead =  computeArrayOverhead<WHICH>(input, query, settings);
-        size_t const nInstances = query->getInstancesCount();
-        InstanceID myId = query->getInstanceID();
-        std::shared_ptr<SharedBuffer> buf(new MemoryBuffer(NULL, sizeof(size_t)));
-        *((size_t*) buf->getWriteData()) = overhead;
-        for(InstanceID i=0; i<nInstances; i++)
+        if(cellCount)
         {
-           if(i != myId)
-           {
-               BufSend(i, buf, query);
-           }
+            *cellCount = totalCount;
         }
-        for(InstanceID i=0; i<nInstances; i++)
-        {
-           if(i != myId)
-           {
-               buf = BufReceive(i,query);
-               size_t otherInstanceSize = *((size_t*) buf->getWriteData());
-               overhead += otherInstanceSize;
-           }
-        }
-        return overhead;
+        return totalCount * tupleOverhead;
     }
 
     /**
-     * If all nodes call this with true - return true.
-     * Otherwise, return false.
+     * @return the estimated hash table footprint of all of input; the number of cells over all instances is also
+     * returned through cellCount, if provided
      */
-    bool agreeOnBoolean(bool value, shared_ptr<Query>& query)
+    template<Handedness WHICH>
+    size_t globalComputeArrayOverhead(shared_ptr<Array> &input, shared_ptr<Query>& query, Settings const& settings, size_t* cellCount = NULL)
     {
-        std::shared_ptr<SharedBuffer> buf(new MemoryBuffer(NULL, sizeof(bool)));
-        InstanceID myId = query->getInstanceID();
-        *((bool*) buf->getWriteData()) = value;
-        for(InstanceID i=0; i<query->getInstancesCount(); i++)
-        {
-            if(i != myId)
-            {
-                BufSend(i, buf, query);
-            }
-        }
-        for(InstanceID i=0; i<query->getInstancesCount(); i++)
+        vector<size_t> totals(2, 0);
+        totals[0] = computeArrayOverhead<WHICH>(input, query, settings, &(totals[1]));
+        globalSum(totals, query);
+        if(cellCount)
         {
-            if(i != myId)
-            {
-                buf = BufReceive(i,query);
-                bool otherInstanceVal = *((bool*) buf->getWriteData());
-                value = value && otherInstanceVal;
-            }
+            *cellCount = totals[1];
         }
-        return value;
+        return totals[0];
     }
 
     struct PreScanResult
@@ -149,11 +124,15 @@ public:
         bool finishedRight;
         size_t leftSizeEstimate;
         size_t rightSizeEstimate;
+        size_t leftCellCount;
+        size_t rightCellCount;
         PreScanResult():
             finishedLeft(false),
             finishedRight(false),
             leftSizeEstimate(0),
-            rightSizeEstimate(0)
+            rightSizeEstimate(0),
+            leftCellCount(0),
+            rightCellCount(0)
         {}
     };
 
@@ -172,37 +151,39 @@ public:
         }
         ArrayDesc const& leftDesc  = inputArrays[0]->getArrayDesc();
         ArrayDesc const& rightDesc = inputArrays[1]->getArrayDesc();
-        size_t leftCellSize  = JoinHashTable::computeTupleOverhead(makeTupledSchema<LEFT> (settings, query).getAttributes(true));
-        size_t rightCellSize = JoinHashTable::computeTupleOverhead(makeTupledSchema<LEFT> (settings, query).getAttributes(true));
+        size_t leftCellSize  = JoinHashTable<>::computeTupleOverhead(makeTupledSchema<LEFT> (settings, query).getAttributes(true));
+        size_t rightCellSize = JoinHashTable<>::computeTupleOverhead(makeTupledSchema<RIGHT>(settings, query).getAttributes(true));
         const auto &leftEbmAttr = leftDesc.getEmptyBitmapAttribute();
         shared_ptr<ConstArrayIterator> laiter = inputArrays[0]->getConstIterator(*leftEbmAttr);
         const auto &rightEbmAttr = rightDesc.getEmptyBitmapAttribute();
         shared_ptr<ConstArrayIterator> raiter = inputArrays[1]->getConstIterator(*rightEbmAttr);
-        size_t leftSize =0, rightSize =0;
+        size_t leftCount =0, rightCount =0;
         size_t const threshold = settings.getHashJoinThreshold();
-        while(leftSize < threshold && rightSize < threshold && !laiter->end() && !raiter->end())
+        while(leftCount * leftCellSize < threshold && rightCount * rightCellSize < threshold && !laiter->end() && !raiter->end())
         {
-            leftSize  += laiter->getChunk().count() * leftCellSize;
-            rightSize += raiter->getChunk().count() * rightCellSize;
+            leftCount  += laiter->getChunk().count();
+            rightCount += raiter->getChunk().count();
             ++(*laiter);
             ++(*raiter);
         }
         if(laiter->end()) //make sure we've scanned at least the same size from both (in case the chunks are differently sized)
         {
-            while(!raiter->end() && rightSize<leftSize)
+            while(!raiter->end() && rightCount * rightCellSize < leftCount * leftCellSize)
             {
-                rightSize += raiter->getChunk().count() * rightCellSize;
+                rightCount += raiter->getChunk().count();
                 ++(*raiter);
             }
         }
         else if(raiter->end())
         {
-            while(!laiter->end() && leftSize<rightSize)
+            while(!laiter->end() && leftCount * leftCellSize < rightCount * rightCellSize)
             {
-                leftSize += laiter->getChunk().count() * leftCellSize;
+                leftCount += laiter->getChunk().count();
                 ++(*laiter);
             }
         }
+        size_t const leftSize  = leftCount  * leftCellSize;
+        size_t const rightSize = rightCount * rightCellSize;
         PreScanResult result;
         if(laiter->end())
         {
@@ -214,6 +195,8 @@ public:
         }
         result.leftSizeEstimate =leftSize;
         result.rightSizeEstimate=rightSize;
+        result.leftCellCount    =leftCount;
+        result.rightCellCount   =rightCount;
         LOG4CXX_DEBUG(logger, "EJ prescan complete left cell overhead "<<leftCellSize<<" right cell overhead "<<rightCellSize
                               <<" leftFinished "<<result.finishedLeft<<" rightFinished "<< result.finishedRight
                               <<" leftSize "<<result.leftSizeEstimate<<" rightSize "<<result.rightSizeEstimate);
@@ -221,55 +204,34 @@ public:
     }
 
     void globalPreScan(vector< shared_ptr< Array> >& inputArrays, shared_ptr<Query>& query, Settings const& settings,
-                       size_t& leftFinished, size_t& rightFinished, size_t& leftSizeEst, size_t& rightSizeEst)
+                       size_t& leftFinished, size_t& rightFinished, size_t& leftSizeEst, size_t& rightSizeEst,
+                       size_t& leftCountEst, size_t& rightCountEst)
     {
-        leftFinished = 0;
-        rightFinished = 0;
-        leftSizeEst = 0;
-        rightSizeEst = 0;
         PreScanResult localResult = localPreScan(inputArrays, query, settings);
-        if(localResult.finishedLeft)
-        {
-            leftFinished++;
-        }
-        if(localResult.finishedRight)
-        {
-            rightFinished++;
-        }
-        leftSizeEst+=localResult.leftSizeEstimate;
-        rightSizeEst+=localResult.rightSizeEstimate;
-        shared_ptr<SharedBuffer> buf(new MemoryBuffer(NULL, sizeof(PreScanResult)));
-        InstanceID myId = query->getInstanceID();
-        *((PreScanResult*) buf->getWriteData()) = localResult;
-        for(InstanceID i=0; i<query->getInstancesCount(); i++)
-        {
-            if(i != myId)
-            {
-                BufSend(i, buf, query);
-            }
-        }
-        for(InstanceID i=0; i<query->getInstancesCount(); i++)
-        {
-            if(i != myId)
-            {
-                buf = BufReceive(i,query);
-                PreScanResult otherInstanceResult = *((PreScanResult*) buf->getWriteData());
-                if(otherInstanceResult.finishedLeft)
-                {
-                    leftFinished++;
-                }
-                if(otherInstanceResult.finishedRight)
-                {
-                    rightFinished++;
-                }
-                leftSizeEst+=otherInstanceResult.leftSizeEstimate;
-                rightSizeEst+=otherInstanceResult.rightSizeEstimate;
-            }
-        }
+        vector<size_t> totals(6);
+        totals[0] = localResult.finishedLeft  ? 1 : 0;
+        totals[1] = localResult.finishedRight ? 1 : 0;
+        totals[2] = localResult.leftSizeEstimate;
+        totals[3] = localResult.rightSizeEstimate;
+        totals[4] = localResult.leftCellCount;
+        totals[5] = localResult.rightCellCount;
+        globalSum(totals, query);
+        leftFinished  = totals[0];
+        rightFinished = totals[1];
+        leftSizeEst   = totals[2];
+        rightSizeEst  = totals[3];
+        leftCountEst  = totals[4];
+        rightCountEst = totals[5];
     }
 
-    Settings::algorithm pickAlgorithm(vector< shared_ptr< Array> >& inputArrays, shared_ptr<Query>& query, Settings const& settings)
+    /**
+     * Decide how to perform the join. cellCounts is set to the number of cells of the left and right arrays over all
+     * instances, where they were counted along the way, and 0 otherwise; a replicated table is sized from them.
+     */
+    Settings::algorithm pickAlgorithm(vector< shared_ptr< Array> >& inputArrays, shared_ptr<Query>& query, Settings const& settings,
+                                      vector<size_t>& cellCounts)
     {
+        cellCounts.assign(2, 0);
         if(settings.algorithmSet()) //user override
         {
             return settings.getAlgorithm();
@@ -277,14 +239,14 @@ public:
         size_t const nInstances = query->getInstancesCount();
         size_t const hashJoinThreshold = settings.getHashJoinThreshold();
         bool leftMaterialized = agreeOnBoolean(inputArrays[0]->isMaterialized(), query);
-        size_t leftOverhead  = leftMaterialized ? globalComputeArrayOverhead<LEFT>(inputArrays[0], query, settings) : -1;
+        size_t leftOverhead  = leftMaterialized ? globalComputeArrayOverhead<LEFT>(inputArrays[0], query, settings, &(cellCounts[0])) : -1;
         LOG4CXX_DEBUG(logger, "EJ left materialized "<<leftMaterialized<< " overhead "<<leftOverhead);
-        if(leftMaterialized && leftOverhead < hashJoinThreshold && settings.isLeftOuter() == false)
+        if(leftMaterialized && leftOverhead < hashJoinThreshold && settings.needsLeftMisses() == false)
         {
             return Settings::HASH_REPLICATE_LEFT;
         }
         bool rightMaterialized = agreeOnBoolean(inputArrays[1]->isMaterialized(), query);
-        size_t rightOverhead = rightMaterialized ? globalComputeArrayOverhead<RIGHT>(inputArrays[1], query, settings) : -1;
+        size_t rightOverhead = rightMaterialized ? globalComputeArrayOverhead<RIGHT>(inputArrays[1], query, settings, &(cellCounts[1])) : -1;
         LOG4CXX_DEBUG(logger, "EJ right materialized "<<rightMaterialized<< " overhead "<<rightOverhead);
         if(rightMaterialized && rightOverhead < hashJoinThreshold && settings.isRightOuter() == false)
         {
@@ -292,16 +254,43 @@ public:
         }
         if(leftMaterialized && rightMaterialized)
         {
-            return leftOverhead < rightOverhead ? Settings::MERGE_LEFT_FIRST : Settings::MERGE_RIGHT_FIRST;
+            //after redistribution, each instance would hold about 1/nInstances of the smaller array; if that is large but
+            //fits, build partitioned tables from it
+            if(leftOverhead < rightOverhead)
+            {
+                size_t const leftShare = leftOverhead / nInstances;
+                if(leftShare >= RADIX_MIN_TABLE_SIZE && leftShare < hashJoinThreshold && settings.needsLeftMisses() == false)
+                {
+                    return Settings::RADIX_PARTITION_LEFT;
+                }
+                return Settings::MERGE_LEFT_FIRST;
+            }
+            size_t const rightShare = rightOverhead / nInstances;
+            if(rightShare >= RADIX_MIN_TABLE_SIZE && rightShare < hashJoinThreshold && settings.isRightOuter() == false)
+            {
+                return Settings::RADIX_PARTITION_RIGHT;
+            }
+            return Settings::MERGE_RIGHT_FIRST;
         }
         size_t leftArraysFinished =0;
         size_t rightArraysFinished=0;
         size_t leftOverheadEst = 0;
         size_t rightOverheadEst =0;
-        globalPreScan(inputArrays, query, settings, leftArraysFinished, rightArraysFinished, leftOverheadEst, rightOverheadEst);
+        size_t leftCountEst = 0;
+        size_t rightCountEst = 0;
+        globalPreScan(inputArrays, query, settings, leftArraysFinished, rightArraysFinished, leftOverheadEst, rightOverheadEst,
+                      leftCountEst, rightCountEst);
         LOG4CXX_DEBUG(logger, "EJ global prescan complete leftFinished "<<leftArraysFinished<<" rightFinished "<< rightArraysFinished<<" leftOverhead "<<leftOverheadEst<<
                       " rightOverhead "<<rightOverheadEst);
-        if(leftArraysFinished == nInstances && leftOverheadEst < hashJoinThreshold && settings.isLeftOuter() == false)
+        if(leftArraysFinished == nInstances)
+        {
+            cellCounts[0] = leftCountEst;
+        }
+        if(rightArraysFinished == nInstances)
+        {
+            cellCounts[1] = rightCountEst;
+        }
+        if(leftArraysFinished == nInstances && leftOverheadEst < hashJoinThreshold && settings.needsLeftMisses() == false)
         {
             return Settings::HASH_REPLICATE_LEFT;
         }
@@ -313,14 +302,133 @@ public:
         return leftArraysFinished < rightArraysFinished ? Settings::MERGE_RIGHT_FIRST : Settings::MERGE_LEFT_FIRST;
     }
 
-    template <Handedness WHICH, ReadArrayType ARRAY_TYPE>
-    void readIntoHashTable(shared_ptr<Array> & array, JoinHashTable& table, Settings const& settings, ChunkFilter<WHICH>* chunkFilterToPopulate = NULL)
+    size_t countChunks(shared_ptr<Array>& input)
     {
-        if ((WHICH == LEFT && settings.isLeftOuter()) || (WHICH == RIGHT && settings.isRightOuter()))
+        size_t result = 0;
+        const auto &ebmAttr = input->getArrayDesc().getEmptyBitmapAttribute();
+        shared_ptr<ConstArrayIterator> aiter(input->getConstIterator(*ebmAttr));
+        while(!aiter->end())
+        {
+            ++result;
+            ++(*aiter);
+        }
+        return result;
+    }
+
+    /**
+     * Build the table with several threads. Each thread reads a contiguous range of chunks into a table of its own,
+     * packing tuples without indexing them, and trains its own copy of the chunk filter. The thread tables are then
+     * adopted in chunk order and indexed, which gives exactly the table a serial build would. The threads share the
+     * arena, so each one sees the footprint of all of them and all stop once one finds it over memoryLimit.
+     * @return false if the table went over memoryLimit and was left incomplete
+     */
+    template <Handedness WHICH, ReadArrayType ARRAY_TYPE, KeyLayout LAYOUT>
+    bool parallelReadIntoHashTable(shared_ptr<Array> & array, JoinHashTable<LAYOUT>& table, Settings const& settings,
+                                   ChunkFilter<WHICH>* chunkFilterToPopulate, size_t const numChunks, size_t const numThreads,
+                                   size_t const memoryLimit)
+    {
+        size_t const tupleSize = (WHICH == LEFT ? settings.getLeftTupleSize() : settings.getRightTupleSize());
+        vector<shared_ptr<JoinHashTable<LAYOUT> > > threadTables(numThreads);
+        vector<shared_ptr<ChunkFilter<WHICH> > > threadFilters(numThreads);
+        vector<std::exception_ptr> errors(numThreads);
+        vector<std::thread> threads;
+        std::atomic<bool> overLimit(false);
+        for(size_t t =0; t<numThreads; ++t)
+        {
+            threadTables[t].reset(new JoinHashTable<LAYOUT>(settings, table.getArena(), tupleSize));
+            if(chunkFilterToPopulate)
+            {
+                threadFilters[t].reset(new ChunkFilter<WHICH>(*chunkFilterToPopulate));
+            }
+        }
+        for(size_t t =0; t<numThreads; ++t)
+        {
+            threads.push_back(std::thread([&, t]()
+            {
+                try
+                {
+                    size_t const firstChunk = numChunks * t / numThreads;
+                    size_t const endChunk   = numChunks * (t+1) / numThreads;
+                    ArrayReader<WHICH, ARRAY_TYPE> reader(array, settings, NULL, firstChunk, endChunk - firstChunk);
+                    size_t numTuples = 0;
+                    while(!reader.end())
+                    {
+                        vector<Value const*> const& tuple = reader.getTuple();
+                        if(threadFilters[t])
+                        {
+                            threadFilters[t]->addTuple(tuple);
+                        }
+                        threadTables[t]->append(tuple);
+                        if(memoryLimit && ++numTuples % MEMORY_CHECK_INTERVAL == 0)
+                        {
+                            if(overLimit || threadTables[t]->usedBytes() > memoryLimit)
+                            {
+                                overLimit = true;
+                                break;
+                            }
+                        }
+                        reader.next();
+                    }
+                    reader.logStats();
+                }
+                catch(...)
+                {
+                    errors[t] = std::current_exception();
+                }
+            }));
+        }
+        for(size_t t =0; t<numThreads; ++t)
+        {
+            threads[t].join();
+        }
+        for(size_t t =0; t<numThreads; ++t)
+        {
+            if(errors[t])
+            {
+                std::rethrow_exception(errors[t]);
+            }
+        }
+        if(overLimit)
+        {
+            return false;
+        }
+        for(size_t t =0; t<numThreads; ++t)
+        {
+            table.adopt(*(threadTables[t]));
+            if(chunkFilterToPopulate)
+            {
+                chunkFilterToPopulate->merge(*(threadFilters[t]));
+            }
+        }
+        table.buildIndex();
+        return memoryLimit == 0 || table.usedBytes() <= memoryLimit;
+    }
+
+    /**
+     * Read array into table. With a non-zero memoryLimit, the footprint of the table is checked as it grows and reading
+     * stops as soon as it goes over the limit.
+     * @return false if the table went over memoryLimit and was left incomplete
+     */
+    template <Handedness WHICH, ReadArrayType ARRAY_TYPE, KeyLayout LAYOUT>
+    bool readIntoHashTable(shared_ptr<Array> & array, JoinHashTable<LAYOUT>& table, Settings const& settings, ChunkFilter<WHICH>* chunkFilterToPopulate = NULL,
+                           size_t const memoryLimit = 0)
+    {
+        if ((WHICH == LEFT && settings.needsLeftMisses()) || (WHICH == RIGHT && settings.isRightOuter()))
         {
             throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION)<<"internal inconsistency";
         }
+        if(settings.getNumThreads() > 1 && array->isMaterialized()) //only materialized arrays are safe to iterate concurrently
+        {
+            size_t const numChunks  = countChunks(array);
+            size_t const numThreads = std::min(settings.getNumThreads(), numChunks);
+            if(numThreads > 1)
+            {
+                LOG4CXX_DEBUG(logger, "EJ building table with "<<numThreads<<" threads over "<<numChunks<<" chunks");
+                return parallelReadIntoHashTable<WHICH, ARRAY_TYPE>(array, table, settings, chunkFilterToPopulate, numChunks, numThreads, memoryLimit);
+            }
+        }
         ArrayReader<WHICH, ARRAY_TYPE> reader(array, settings);
+        size_t numTuples = 0;
         while(!reader.end())
         {
             vector<Value const*> const& tuple = reader.getTuple();
@@ -328,40 +436,459 @@ public:
             {
                 chunkFilterToPopulate->addTuple(tuple);
             }
-            table.insert(tuple);
+            table.append(tuple);
+            if(memoryLimit && ++numTuples % MEMORY_CHECK_INTERVAL == 0 && table.usedBytes() > memoryLimit)
+            {
+                LOG4CXX_DEBUG(logger, "EJ table over memory limit "<<memoryLimit<<" after "<<numTuples<<" tuples");
+                return false;
+            }
+            reader.next();
+        }
+        reader.logStats();
+        table.buildIndex(); //all keys are seen first, so dense ones can be indexed directly
+        return memoryLimit == 0 || table.usedBytes() <= memoryLimit;
+    }
+
+    /**
+     * Look up one tuple of the array with iter, writing matches (and the miss, if outer) to result.
+     * @param firstMatchOnly stop at the first match, for semi and anti joins
+     */
+    template <Handedness WHICH_IS_IN_TABLE, bool ARRAY_OUTER_JOIN, KeyLayout LAYOUT>
+    void probeTuple(vector<Value const*> const& tuple, typename JoinHashTable<LAYOUT>::const_iterator& iter, ArrayWriter<WRITE_OUTPUT>& result,
+                    size_t const numKeys, bool const firstMatchOnly)
+    {
+        if(ARRAY_OUTER_JOIN && isNullTuple(tuple, numKeys))
+        {
+            result.writeOuterTuple<WHICH_IS_IN_TABLE == LEFT ? RIGHT : LEFT> (tuple);
+            return;
+        }
+        iter.find(tuple);
+        if (ARRAY_OUTER_JOIN && iter.end())
+        {
+            result.writeOuterTuple<WHICH_IS_IN_TABLE == LEFT ? RIGHT : LEFT> (tuple);
+            return;
+        }
+        while(!iter.end()) //find() lands on the group with exactly these keys
+        {
+            Value const* tablePiece = iter.getTuple();
+            if(WHICH_IS_IN_TABLE == LEFT)
+            {
+                result.writeTuple(tablePiece, tuple);
+            }
+            else
+            {
+                result.writeTuple(tuple, tablePiece);
+            }
+            if(firstMatchOnly)
+            {
+                return;
+            }
+            iter.nextAtHash();
+        }
+    }
+
+    /**
+     * Look up a batch of tuples with iter.findBatch and write out the matches (and misses, if outer) in batch order.
+     * @param firstMatchOnly write only the first match of each tuple, for semi and anti joins
+     */
+    template <Handedness WHICH_IS_IN_TABLE, bool ARRAY_OUTER_JOIN, KeyLayout LAYOUT>
+    void probeBatch(vector<vector<Value const*> > const& batch, size_t const batchSize, typename JoinHashTable<LAYOUT>::const_iterator& iter,
+                    vector<std::pair<size_t, size_t> >& matches, ArrayWriter<WRITE_OUTPUT>& result, bool const firstMatchOnly)
+    {
+        iter.findBatch(batch, batchSize, matches);
+        size_t m = 0;
+        for(size_t i =0; i<batchSize; ++i)
+        {
+            if(ARRAY_OUTER_JOIN && (m == matches.size() || matches[m].first != i))
+            {
+                result.writeOuterTuple<WHICH_IS_IN_TABLE == LEFT ? RIGHT : LEFT> (batch[i]);
+            }
+            size_t const firstMatch = m;
+            for(; m < matches.size() && matches[m].first == i; ++m)
+            {
+                if(firstMatchOnly && m != firstMatch)
+                {
+                    continue;
+                }
+                Value const* tablePiece = iter.getRowTuple(matches[m].second);
+                if(WHICH_IS_IN_TABLE == LEFT)
+                {
+                    result.writeTuple(tablePiece, batch[i]);
+                }
+                else
+                {
+                    result.writeTuple(batch[i], tablePiece);
+                }
+            }
+        }
+    }
+
+    /**
+     * Probe the table with every tuple of reader, writing matches (and misses, if outer) to result. Tuples are copied
+     * out of the reader and looked up PROBE_BATCH_SIZE at a time.
+     */
+    template <Handedness WHICH_IS_IN_TABLE, ReadArrayType ARRAY_TYPE, bool ARRAY_OUTER_JOIN, KeyLayout LAYOUT>
+    void probeTable(ArrayReader<WHICH_IS_IN_TABLE == LEFT ? RIGHT : LEFT, ARRAY_TYPE, ARRAY_OUTER_JOIN>& reader, JoinHashTable<LAYOUT> const& table,
+                    ArrayWriter<WRITE_OUTPUT>& result, Settings const& settings)
+    {
+        typename JoinHashTable<LAYOUT>::const_iterator iter = table.getIterator();
+        size_t const numKeys = settings.getNumKeys();
+        size_t const arrayTupleSize = (WHICH_IS_IN_TABLE == LEFT ? settings.getRightTupleSize() : settings.getLeftTupleSize());
+        vector<Value> values(PROBE_BATCH_SIZE * arrayTupleSize);
+        vector<vector<Value const*> > batch(PROBE_BATCH_SIZE, vector<Value const*>(arrayTupleSize));
+        vector<std::pair<size_t, size_t> > matches;
+        bool const firstMatchOnly = settings.isSemiOrAntiJoin();
+        for(size_t i =0; i<PROBE_BATCH_SIZE; ++i)
+        {
+            for(size_t j =0; j<arrayTupleSize; ++j)
+            {
+                batch[i][j] = &(values[i * arrayTupleSize + j]);
+            }
+        }
+        size_t batchSize = 0;
+        while(!reader.end())
+        {
+            vector<Value const*> const& tuple = reader.getTuple();
+            if(ARRAY_OUTER_JOIN && isNullTuple(tuple, numKeys)) //not looked up; the batch goes first to keep the order
+            {
+                probeBatch<WHICH_IS_IN_TABLE, ARRAY_OUTER_JOIN, LAYOUT>(batch, batchSize, iter, matches, result, firstMatchOnly);
+                batchSize = 0;
+                result.writeOuterTuple<WHICH_IS_IN_TABLE == LEFT ? RIGHT : LEFT> (tuple);
+                reader.next();
+                continue;
+            }
+            for(size_t j =0; j<arrayTupleSize; ++j)
+            {
+                values[batchSize * arrayTupleSize + j] = *(tuple[j]);
+            }
+            if(++batchSize == PROBE_BATCH_SIZE)
+            {
+                probeBatch<WHICH_IS_IN_TABLE, ARRAY_OUTER_JOIN, LAYOUT>(batch, batchSize, iter, matches, result, firstMatchOnly);
+                batchSize = 0;
+            }
             reader.next();
         }
+        probeBatch<WHICH_IS_IN_TABLE, ARRAY_OUTER_JOIN, LAYOUT>(batch, batchSize, iter, matches, result, firstMatchOnly);
         reader.logStats();
     }
 
-    template <Handedness WHICH_IS_IN_TABLE, ReadArrayType ARRAY_TYPE, bool ARRAY_OUTER_JOIN>
-    shared_ptr<Array> arrayToTableJoin(shared_ptr<Array>& array, JoinHashTable& table, shared_ptr<Query>& query,
+    /**
+     * Probe the table with several threads. Each thread reads a contiguous range of chunks of the array and writes to an
+     * output array of its own; the thread outputs are then concatenated in chunk order, so the result is the same as
+     * that of a serial probe.
+     */
+    template <Handedness WHICH_IS_IN_TABLE, ReadArrayType ARRAY_TYPE, bool ARRAY_OUTER_JOIN, KeyLayout LAYOUT>
+    shared_ptr<Array> parallelArrayToTableJoin(shared_ptr<Array>& array, JoinHashTable<LAYOUT> const& table, shared_ptr<Query>& query,
+                                               Settings const& settings, ChunkFilter<WHICH_IS_IN_TABLE> const* chunkFilter,
+                                               size_t const numChunks, size_t const numThreads)
+    {
+        vector<shared_ptr<ArrayWriter<WRITE_OUTPUT> > > threadResults(numThreads);
+        vector<shared_ptr<ChunkFilter<WHICH_IS_IN_TABLE> > > threadFilters(numThreads); //filters keep scratch space
+        vector<std::exception_ptr> errors(numThreads);
+        vector<std::thread> threads;
+        for(size_t t =0; t<numThreads; ++t)
+        {
+            threadResults[t].reset(new ArrayWriter<WRITE_OUTPUT>(settings, query, _schema));
+            if(chunkFilter)
+            {
+                threadFilters[t].reset(new ChunkFilter<WHICH_IS_IN_TABLE>(*chunkFilter));
+            }
+        }
+        for(size_t t =0; t<numThreads; ++t)
+        {
+            threads.push_back(std::thread([&, t]()
+            {
+                try
+                {
+                    size_t const firstChunk = numChunks * t / numThreads;
+                    size_t const endChunk   = numChunks * (t+1) / numThreads;
+                    ArrayReader<WHICH_IS_IN_TABLE == LEFT ? RIGHT : LEFT, ARRAY_TYPE, ARRAY_OUTER_JOIN> reader(array, settings, threadFilters[t].get(),
+                                                                                                             firstChunk, endChunk - firstChunk);
+                    probeTable<WHICH_IS_IN_TABLE, ARRAY_TYPE, ARRAY_OUTER_JOIN>(reader, table, *(threadResults[t]), settings);
+                }
+                catch(...)
+                {
+                    errors[t] = std::current_exception();
+                }
+            }));
+        }
+        for(size_t t =0; t<numThreads; ++t)
+        {
+            threads[t].join();
+        }
+        for(size_t t =0; t<numThreads; ++t)
+        {
+            if(errors[t])
+            {
+                std::rethrow_exception(errors[t]);
+            }
+        }
+        ArrayWriter<WRITE_OUTPUT> result(settings, query, _schema);
+        for(size_t t =0; t<numThreads; ++t)
+        {
+            result.appendArray(threadResults[t]->finalize());
+            threadResults[t].reset();
+        }
+        return result.finalize();
+    }
+
+    template <Handedness WHICH_IS_IN_TABLE, ReadArrayType ARRAY_TYPE, bool ARRAY_OUTER_JOIN, KeyLayout LAYOUT>
+    shared_ptr<Array> arrayToTableJoin(shared_ptr<Array>& array, JoinHashTable<LAYOUT>& table, shared_ptr<Query>& query,
                                        Settings const& settings, ChunkFilter<WHICH_IS_IN_TABLE> const* chunkFilter = NULL)
     {
         //handedness LEFT means the LEFT array is in table so this reads in reverse
         //ARRAY_OUTER_JOIN means the join is outer on the side of the array. The table doesn't support outer joins, so if we were outer
         //on the other side, we wouldn't be in this loop.
-        ArrayReader<WHICH_IS_IN_TABLE == LEFT ? RIGHT : LEFT, ARRAY_TYPE, ARRAY_OUTER_JOIN> reader(array, settings, chunkFilter, NULL);
+        if(settings.getNumThreads() > 1 && array->isMaterialized()) //only materialized arrays are safe to iterate concurrently
+        {
+            size_t const numChunks  = countChunks(array);
+            size_t const numThreads = std::min(settings.getNumThreads(), numChunks);
+            if(numThreads > 1)
+            {
+                LOG4CXX_DEBUG(logger, "EJ probing table with "<<numThreads<<" threads over "<<numChunks<<" chunks");
+                return parallelArrayToTableJoin<WHICH_IS_IN_TABLE, ARRAY_TYPE, ARRAY_OUTER_JOIN>(array, table, query, settings, chunkFilter, numChunks, numThreads);
+            }
+        }
+        ArrayReader<WHICH_IS_IN_TABLE == LEFT ? RIGHT : LEFT, ARRAY_TYPE, ARRAY_OUTER_JOIN> reader(array, settings, chunkFilter);
         ArrayWriter<WRITE_OUTPUT> result(settings, query, _schema);
-        JoinHashTable::const_iterator iter = table.getIterator();
+        probeTable<WHICH_IS_IN_TABLE, ARRAY_TYPE, ARRAY_OUTER_JOIN>(reader, table, result, settings);
+        return result.finalize();
+    }
+
+    /**
+     * Join two tupled arrays that are colocated by hash when the WHICH_IS_IN_TABLE one does not fit in memory. Both are
+     * split into partitions by hash. Table partitions are kept in hash tables while their total footprint is within the
+     * hash_join_threshold; the others, and the matching partitions of the other array, are spilled to MemArrays (which
+     * page out to temporary storage as needed) and joined one partition at a time at the end. Tuples of the other array
+     * that fall into an in-memory partition are joined as they are read.
+     */
+    template <Handedness WHICH_IS_IN_TABLE, bool ARRAY_OUTER_JOIN, KeyLayout LAYOUT>
+    shared_ptr<Array> hybridHashJoin(shared_ptr<Array>& tableArray, shared_ptr<Array>& array, shared_ptr<Query>& query, Settings const& settings,
+                                     size_t const tableOverhead, size_t const tableCount)
+    {
+        Handedness const WHICH_IS_ARRAY = (WHICH_IS_IN_TABLE == LEFT ? RIGHT : LEFT);
+        size_t const tableTupleSize = (WHICH_IS_IN_TABLE == LEFT ? settings.getLeftTupleSize() : settings.getRightTupleSize());
+        size_t const arrayTupleSize = (WHICH_IS_IN_TABLE == LEFT ? settings.getRightTupleSize() : settings.getLeftTupleSize());
         size_t const numKeys = settings.getNumKeys();
-        while(!reader.end())
+        size_t const budget = settings.getHashJoinThreshold();
+        size_t numPartitions = 2;
+        size_t partitionShift = 63; //the partition is the top bits of a remix of the hash
+        while(numPartitions < MAX_HYBRID_PARTITIONS && numPartitions * budget < 2 * tableOverhead) //aim for partitions of half the budget
         {
-            vector<Value const*> const& tuple = reader.getTuple();
-            if(ARRAY_OUTER_JOIN && isNullTuple(tuple, numKeys))
+            numPartitions <<= 1;
+            --partitionShift;
+        }
+        size_t const numInMemory = std::min(numPartitions, budget * numPartitions / std::max<size_t>(tableOverhead, 1));
+        LOG4CXX_DEBUG(logger, "EJ hybrid hash partitions "<<numPartitions<<" starting in memory "<<numInMemory<<" budget "<<budget);
+        ArenaPtr operatorArena = this->getArena();
+        ArenaPtr hashArena(newArena(Options("").resetting(true).threading(true).pagesize(8 * 1024 * 1024).parent(operatorArena)));
+        vector<shared_ptr<JoinHashTable<LAYOUT> > > tables(numPartitions);
+        for(size_t p =0; p<numInMemory; ++p)
+        {
+            //an arena of its own, so that the footprint of the partition can be told and given back when spilled; rows
+            //keep the hash that follows the tuple, so that they are spilled as they came in
+            ArenaPtr partitionArena(newArena(Options("").resetting(true).threading(false).parent(hashArena)));
+            tables[p].reset(new JoinHashTable<LAYOUT>(settings, partitionArena, tableTupleSize + 1, tableCount / numPartitions));
+        }
+        vector<shared_ptr<ArrayWriter<WRITE_TUPLED> > > tableSpills(numPartitions);
+        vector<shared_ptr<ArrayWriter<WRITE_TUPLED> > > arraySpills(numPartitions);
+        ArrayDesc const tableSpillSchema = makeTupledSchema<WHICH_IS_IN_TABLE>(settings, query);
+        ArrayDesc const arraySpillSchema = makeTupledSchema<WHICH_IS_ARRAY>(settings, query);
+        size_t usedBytes = 0;
+        {
+            ArrayReader<WHICH_IS_IN_TABLE, READ_TUPLED> tableReader(tableArray, settings);
+            vector<Value const*> spillTuple(tableTupleSize + 1);
+            while(!tableReader.end())
             {
-                result.writeOuterTuple<WHICH_IS_IN_TABLE == LEFT ? RIGHT : LEFT> (tuple);
+                vector<Value const*> const& tuple = tableReader.getTuple();
+                size_t const partition = fmix(tuple[tableTupleSize]->getUint64()) >> partitionShift; //the hash follows the tuple
+                if(tables[partition])
+                {
+                    size_t const before = tables[partition]->usedBytes();
+                    tables[partition]->insert(tuple);
+                    usedBytes = usedBytes + tables[partition]->usedBytes() - before;
+                    while(usedBytes > budget) //spill the largest partitions, to free the most with the fewest spills
+                    {
+                        size_t victim = numPartitions;
+                        for(size_t p =0; p<numPartitions; ++p)
+                        {
+                            if(tables[p] && (victim == numPartitions || tables[p]->usedBytes() > tables[victim]->usedBytes()))
+                            {
+                                victim = p;
+                            }
+                        }
+                        if(victim == numPartitions)
+                        {
+                            break;
+                        }
+                        LOG4CXX_DEBUG(logger, "EJ hybrid hash spilling partition "<<victim<<" at "<<usedBytes<<" bytes");
+                        tableSpills[victim].reset(new ArrayWriter<WRITE_TUPLED>(settings, query, tableSpillSchema));
+                        for(typename JoinHashTable<LAYOUT>::const_iterator iter = tables[victim]->getIterator(); !iter.end(); iter.next())
+                        {
+                            Value const* tablePiece = iter.getTuple();
+                            for(size_t i =0; i<=tableTupleSize; ++i)
+                            {
+                                spillTuple[i] = &(tablePiece[i]);
+                            }
+                            tableSpills[victim]->writeTuple(spillTuple);
+                        }
+                        usedBytes -= tables[victim]->usedBytes();
+                        tables[victim].reset();
+                    }
+                }
+                else
+                {
+                    if(!tableSpills[partition])
+                    {
+                        tableSpills[partition].reset(new ArrayWriter<WRITE_TUPLED>(settings, query, tableSpillSchema));
+                    }
+                    tableSpills[partition]->writeTuple(tuple);
+                }
+                tableReader.next();
+            }
+            tableReader.logStats();
+        }
+        ArrayWriter<WRITE_OUTPUT> result(settings, query, _schema);
+        {
+            vector<shared_ptr<typename JoinHashTable<LAYOUT>::const_iterator> > iters(numPartitions);
+            for(size_t p =0; p<numPartitions; ++p)
+            {
+                if(tables[p])
+                {
+                    iters[p].reset(new typename JoinHashTable<LAYOUT>::const_iterator(tables[p]->getIterator()));
+                }
+            }
+            ArrayReader<WHICH_IS_ARRAY, READ_TUPLED, ARRAY_OUTER_JOIN> reader(array, settings);
+            while(!reader.end())
+            {
+                vector<Value const*> const& tuple = reader.getTuple();
+                size_t const partition = fmix(tuple[arrayTupleSize]->getUint64()) >> partitionShift;
+                if(iters[partition])
+                {
+                    probeTuple<WHICH_IS_IN_TABLE, ARRAY_OUTER_JOIN, LAYOUT>(tuple, *(iters[partition]), result, numKeys, settings.isSemiOrAntiJoin());
+                }
+                else
+                {
+                    if(!arraySpills[partition])
+                    {
+                        arraySpills[partition].reset(new ArrayWriter<WRITE_TUPLED>(settings, query, arraySpillSchema));
+                    }
+                    arraySpills[partition]->writeTuple(tuple);
+                }
                 reader.next();
-                continue;
             }
-            iter.find(tuple);
-            if (ARRAY_OUTER_JOIN && iter.end())
+            reader.logStats();
+        }
+        tables.clear();
+        for(size_t p =0; p<numPartitions; ++p)
+        {
+            if(!arraySpills[p])
             {
-                result.writeOuterTuple<WHICH_IS_IN_TABLE == LEFT ? RIGHT : LEFT> (tuple);
+                continue; //nothing to join with, and the table side is never outer
             }
-            else
+            ArenaPtr partitionArena(newArena(Options("").resetting(true).threading(true).parent(hashArena)));
+            JoinHashTable<LAYOUT> table(settings, partitionArena, tableTupleSize);
+            if(tableSpills[p])
             {
-                while(!iter.end() && iter.atKeys(tuple))
+                shared_ptr<Array> spilled = tableSpills[p]->finalize();
+                tableSpills[p].reset();
+                readIntoHashTable<WHICH_IS_IN_TABLE, READ_TUPLED>(spilled, table, settings);
+            }
+            LOG4CXX_DEBUG(logger, "EJ hybrid hash joining spilled partition "<<p<<" table rows "<<table.getNumTuples());
+            shared_ptr<Array> spilled = arraySpills[p]->finalize();
+            arraySpills[p].reset();
+            ArrayReader<WHICH_IS_ARRAY, READ_TUPLED, ARRAY_OUTER_JOIN> reader(spilled, settings);
+            probeTable<WHICH_IS_IN_TABLE, READ_TUPLED, ARRAY_OUTER_JOIN>(reader, table, result, settings);
+        }
+        return result.finalize();
+    }
+
+    /**
+     * Join two tupled arrays that are colocated by hash, keeping the WHICH_IS_IN_TABLE one in a PartitionedJoinHashTable.
+     * The other array is read in batches; each batch is sorted by partition and then probed one partition at a time, so
+     * that lookups hit a cache-sized table rather than all of memory.
+     */
+    template <Handedness WHICH_IS_IN_TABLE, bool ARRAY_OUTER_JOIN, KeyLayout LAYOUT>
+    shared_ptr<Array> radixHashJoin(shared_ptr<Array>& tableArray, shared_ptr<Array>& array, shared_ptr<Query>& query, Settings const& settings,
+                                    size_t const tableOverhead, size_t const tableCount)
+    {
+        Handedness const WHICH_IS_ARRAY = (WHICH_IS_IN_TABLE == LEFT ? RIGHT : LEFT);
+        size_t const tableTupleSize = (WHICH_IS_IN_TABLE == LEFT ? settings.getLeftTupleSize() : settings.getRightTupleSize());
+        size_t const arrayTupleSize = (WHICH_IS_IN_TABLE == LEFT ? settings.getRightTupleSize() : settings.getLeftTupleSize());
+        size_t const numKeys = settings.getNumKeys();
+        ArenaPtr operatorArena = this->getArena();
+        ArenaPtr hashArena(newArena(Options("").resetting(true).threading(false).pagesize(8 * 1024 * 1024).parent(operatorArena)));
+        PartitionedJoinHashTable<LAYOUT> table(settings, hashArena, tableTupleSize, tableOverhead, tableCount);
+        {
+            ArrayReader<WHICH_IS_IN_TABLE, READ_TUPLED> tableReader(tableArray, settings);
+            while(!tableReader.end())
+            {
+                vector<Value const*> const& tuple = tableReader.getTuple();
+                table.append(tuple, tuple[tableTupleSize]->getUint64()); //the hash follows the tuple
+                tableReader.next();
+            }
+            tableReader.logStats();
+        }
+        table.buildIndex();
+        table.logStuff();
+        size_t const numPartitions = table.getNumPartitions();
+        vector<typename JoinHashTable<LAYOUT>::const_iterator> iters;
+        iters.reserve(numPartitions);
+        for(size_t i =0; i<numPartitions; ++i)
+        {
+            iters.push_back(table.getPartition(i).getIterator());
+        }
+        ArrayReader<WHICH_IS_ARRAY, READ_TUPLED, ARRAY_OUTER_JOIN> reader(array, settings);
+        ArrayWriter<WRITE_OUTPUT> result(settings, query, _schema);
+        vector<Value> batch(RADIX_BATCH_SIZE * arrayTupleSize);
+        vector<size_t> batchPartitions(RADIX_BATCH_SIZE);
+        vector<size_t> batchOrder(RADIX_BATCH_SIZE);
+        vector<size_t> partitionStarts(numPartitions + 1);
+        vector<Value const*> tuple(arrayTupleSize);
+        while(!reader.end())
+        {
+            size_t batchSize = 0;
+            std::fill(partitionStarts.begin(), partitionStarts.end(), 0);
+            for(; batchSize < RADIX_BATCH_SIZE && !reader.end(); reader.next())
+            {
+                vector<Value const*> const& input = reader.getTuple();
+                if(ARRAY_OUTER_JOIN && isNullTuple(input, numKeys))
+                {
+                    result.writeOuterTuple<WHICH_IS_ARRAY> (input);
+                    continue;
+                }
+                for(size_t i =0; i<arrayTupleSize; ++i)
+                {
+                    batch[batchSize * arrayTupleSize + i] = *(input[i]);
+                }
+                size_t const partition = table.partitionOf(input[arrayTupleSize]->getUint64());
+                batchPartitions[batchSize] = partition;
+                ++partitionStarts[partition + 1];
+                ++batchSize;
+            }
+            for(size_t i =0; i<numPartitions; ++i)
+            {
+                partitionStarts[i + 1] += partitionStarts[i];
+            }
+            for(size_t i =0; i<batchSize; ++i)
+            {
+                batchOrder[partitionStarts[batchPartitions[i]]++] = i;
+            }
+            for(size_t i =0; i<batchSize; ++i)
+            {
+                size_t const idx = batchOrder[i];
+                for(size_t j =0; j<arrayTupleSize; ++j)
+                {
+                    tuple[j] = &(batch[idx * arrayTupleSize + j]);
+                }
+                typename JoinHashTable<LAYOUT>::const_iterator& iter = iters[batchPartitions[idx]];
+                iter.find(tuple);
+                if (ARRAY_OUTER_JOIN && iter.end())
+                {
+                    result.writeOuterTuple<WHICH_IS_ARRAY> (tuple);
+                    continue;
+                }
+                while(!iter.end()) //find() lands on the group with exactly these keys
                 {
                     Value const* tablePiece = iter.getTuple();
                     if(WHICH_IS_IN_TABLE == LEFT)
@@ -372,51 +899,267 @@ public:
                     {
                         result.writeTuple(tuple, tablePiece);
                     }
+                    if(settings.isSemiOrAntiJoin())
+                    {
+                        break;
+                    }
                     iter.nextAtHash();
                 }
             }
-            reader.next();
         }
         reader.logStats();
         return result.finalize();
     }
 
-    template <Handedness WHICH_REPLICATED>
-    shared_ptr<Array> replicationHashJoin(vector< shared_ptr< Array> >& inputArrays, shared_ptr<Query> query, Settings const& settings)
+    /**
+     * Build the same table on every instance without replicating array: each instance packs its local tuples into a
+     * table of its own and trains filter on them, then sends the rows, with their keys, to all others. The parts are
+     * loaded in instance order, without hashing anything again, and indexed. The total size is agreed on first, so
+     * that nothing is sent when the table would not fit under the memory limit.
+     * @return false if the table goes over the memory limit, in which case it may be left incomplete
+     */
+    template <Handedness WHICH, KeyLayout LAYOUT>
+    bool broadcastIntoHashTable(shared_ptr<Array>& array, JoinHashTable<LAYOUT>& table, shared_ptr<Query>& query, Settings const& settings,
+                                ChunkFilter<WHICH>* filter, size_t const memoryLimit)
+    {
+        JoinHashTable<LAYOUT> local(settings, table.getArena(), WHICH == LEFT ? settings.getLeftTupleSize() : settings.getRightTupleSize());
+        ArrayReader<WHICH, READ_INPUT> reader(array, settings);
+        while(!reader.end())
+        {
+            vector<Value const*> const& tuple = reader.getTuple();
+            if(filter)
+            {
+                filter->addTuple(tuple);
+            }
+            local.append(tuple);
+            reader.next();
+        }
+        reader.logStats();
+        if(filter)
+        {
+            filter->globalExchange(query);
+        }
+        vector<size_t> totalBytes(1, local.usedBytes());
+        globalSum(totalBytes, query);
+        LOG4CXX_DEBUG(logger, "EJ broadcast table local bytes "<<local.usedBytes()<<" total bytes "<<totalBytes[0]);
+        if(memoryLimit && totalBytes[0] > memoryLimit)
+        {
+            return false;
+        }
+        size_t const nInstances = query->getInstancesCount();
+        InstanceID myId = query->getInstanceID();
+        shared_ptr<SharedBuffer> buf(new MemoryBuffer(NULL, local.serializedSize()));
+        local.serialize((char*) buf->getWriteData());
+        for(InstanceID i=0; i<nInstances; i++)
+        {
+            if(i != myId)
+            {
+                BufSend(i, buf, query);
+            }
+        }
+        buf.reset();
+        for(InstanceID i=0; i<nInstances; i++)
+        {
+            if(i == myId)
+            {
+                table.adopt(local);
+            }
+            else
+            {
+                table.appendSerialized((char const*) BufReceive(i, query)->getWriteData());
+            }
+        }
+        table.buildIndex();
+        return memoryLimit == 0 || table.usedBytes() <= memoryLimit;
+    }
+
+    /**
+     * Fill table with all the tuples of input, on every instance, by broadcasting or replicating it. An abandoned table
+     * is followed by a merge join that reads input again, so a single-pass input is materialized first if memory_limit
+     * was given; under the default limit it is read once and the table is built with no limit, as it always was.
+     * @return false if the table goes over the memory limit on this instance
+     */
+    template <Handedness WHICH_REPLICATED, KeyLayout LAYOUT>
+    bool buildReplicatedTable(shared_ptr<Array>& input, JoinHashTable<LAYOUT>& table, shared_ptr<Query>& query, Settings const& settings,
+                              ChunkFilter<WHICH_REPLICATED>* filter)
+    {
+        size_t memoryLimit = settings.getMemoryLimit();
+        if(memoryLimit && input->getSupportedAccess() == Array::SINGLE_PASS)
+        {
+            if(settings.isMemoryLimitSet())
+            {
+                LOG4CXX_DEBUG(logger, "EJ ensuring replicated input random access");
+                input = ensureRandomAccess(input, query); //we may need to read it again
+            }
+            else
+            {
+                LOG4CXX_DEBUG(logger, "EJ replicated input is single pass, building table without the default memory limit");
+                memoryLimit = 0;
+            }
+        }
+        if(settings.broadcastTable())
+        {
+            LOG4CXX_DEBUG(logger, "EJ broadcasting table");
+            return broadcastIntoHashTable<WHICH_REPLICATED>(input, table, query, settings, filter, memoryLimit);
+        }
+        shared_ptr<Array> redistributed = redistributeToRandomAccess(input, createDistribution(dtReplication), ArrayResPtr(), query, shared_from_this());
+        return readIntoHashTable<WHICH_REPLICATED, READ_INPUT> (redistributed, table, settings, filter, memoryLimit);
+    }
+
+    /**
+     * Hash join the array that was not replicated against table.
+     */
+    template <Handedness WHICH_REPLICATED, KeyLayout LAYOUT>
+    shared_ptr<Array> probeReplicatedTable(vector< shared_ptr< Array> >& inputArrays, JoinHashTable<LAYOUT>& table, shared_ptr<Query>& query,
+                                           Settings const& settings, ChunkFilter<WHICH_REPLICATED>* filter)
+    {
+        shared_ptr<Array>& probed = (WHICH_REPLICATED == LEFT ? inputArrays[1] : inputArrays[0]);
+        if(settings.needsLeftMisses() || settings.isRightOuter())
+        {
+            //a semi join does not output left chunks without matches, so they can still be skipped
+            return arrayToTableJoin<WHICH_REPLICATED, READ_INPUT, true>(probed, table, query, settings, settings.isSemiJoin() ? filter : NULL);
+        }
+        return arrayToTableJoin<WHICH_REPLICATED, READ_INPUT, false>(probed, table, query, settings, filter);
+    }
+
+    /**
+     * Describe everything that a replicated table and its chunk filter depend on, other than the contents of the
+     * replicated array: the layout, the tuple mappings of both arrays, the instance count, the chunking of the filtered
+     * array and which of its key attributes the chunk filter keeps ranges for.
+     */
+    template <Handedness WHICH_REPLICATED, KeyLayout LAYOUT>
+    string getTableCacheKey(shared_ptr<Query>& query, Settings const& settings)
+    {
+        ostringstream key;
+        key<<(WHICH_REPLICATED == LEFT ? "L" : "R")<<" "<<LAYOUT<<" "<<query->getInstancesCount()<<" "<<settings.getBloomFilterSize()<<" "<<settings.getBloomFilterHashes();
+        size_t const numFields = WHICH_REPLICATED == LEFT ? settings.getNumLeftAttrs() + settings.getNumLeftDims() :
+                                                            settings.getNumRightAttrs() + settings.getNumRightDims();
+        key<<" map";
+        for(size_t i=0; i<numFields; ++i)
+        {
+            key<<" "<<(WHICH_REPLICATED == LEFT ? settings.mapLeftToTuple(i) : settings.mapRightToTuple(i));
+        }
+        ArrayDesc const& filtered = WHICH_REPLICATED == LEFT ? settings.getRightSchema() : settings.getLeftSchema();
+        size_t const numFilteredAttrs  = WHICH_REPLICATED == LEFT ? settings.getNumRightAttrs() : settings.getNumLeftAttrs();
+        size_t const numFilteredFields = WHICH_REPLICATED == LEFT ? settings.getNumRightAttrs() + settings.getNumRightDims() :
+                                                                    settings.getNumLeftAttrs() + settings.getNumLeftDims();
+        key<<" filtered map";
+        for(size_t i=0; i<numFilteredFields; ++i)
+        {
+            bool const isKey = WHICH_REPLICATED == LEFT ? settings.isRightKey(i) : settings.isLeftKey(i);
+            key<<" "<<(isKey ? "k" : "")<<(WHICH_REPLICATED == LEFT ? settings.mapRightToTuple(i) : settings.mapLeftToTuple(i));
+        }
+        key<<" zones";
+        for(size_t i=0; i<numFilteredAttrs; ++i)
+        {
+            if((WHICH_REPLICATED == LEFT ? settings.isRightKey(i) : settings.isLeftKey(i)) &&
+               ChunkFilter<WHICH_REPLICATED>::isZoneType(filtered.getAttributes(true).findattr(i).getType()))
+            {
+                key<<" "<<i;
+            }
+        }
+        key<<" dims";
+        for(size_t i=0; i<filtered.getDimensions().size(); ++i)
+        {
+            DimensionDesc const& dimension = filtered.getDimensions()[i];
+            key<<" "<<dimension.getStartMin()<<":"<<dimension.getChunkInterval();
+        }
+        return key.str();
+    }
+
+    /**
+     * Replicate one array to every instance and hash join the other one against it. If the table goes over the memory
+     * limit on any instance, all instances abandon it together and return NULL, so that the caller can fall back to
+     * a merge join; the inputs are then still there to be read again. With cache_table, a table built from a stored
+     * array is kept in the TableCache and reused by later queries against the same version of that array.
+     */
+    template <Handedness WHICH_REPLICATED, KeyLayout LAYOUT>
+    shared_ptr<Array> replicationHashJoin(vector< shared_ptr< Array> >& inputArrays, shared_ptr<Query> query, Settings const& settings,
+                                          size_t const tableSizeHint)
     {
-        if((WHICH_REPLICATED == LEFT && settings.isLeftOuter()) || (WHICH_REPLICATED == RIGHT && settings.isRightOuter()))
+        if((WHICH_REPLICATED == LEFT && settings.needsLeftMisses()) || (WHICH_REPLICATED == RIGHT && settings.isRightOuter()))
         {
             throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "Internal inconsistency";
         }
-        shared_ptr<Array> redistributed = (WHICH_REPLICATED == LEFT ? inputArrays[0] : inputArrays[1]);
-        redistributed = redistributeToRandomAccess(redistributed, createDistribution(dtReplication), ArrayResPtr(), query, shared_from_this());
+        shared_ptr<Array>& input = (WHICH_REPLICATED == LEFT ? inputArrays[0] : inputArrays[1]);
+        if(settings.cacheTable())
+        {
+            ArrayDesc const& desc = WHICH_REPLICATED == LEFT ? settings.getLeftSchema() : settings.getRightSchema();
+            ArrayID const uaid = desc.getUAId();
+            VersionID const version = desc.getVersionId();
+            bool const cacheable = input->isMaterialized() && uaid != 0 && uaid != INVALID_ARRAY_ID && version != 0;
+            if(agreeOnBoolean(cacheable, query))
+            {
+                return cachedReplicationHashJoin<WHICH_REPLICATED, LAYOUT>(inputArrays, query, settings, tableSizeHint, uaid, version);
+            }
+            LOG4CXX_DEBUG(logger, "EJ replicated input is not a stored array, not caching");
+        }
         ArenaPtr operatorArena = this->getArena();
-        ArenaPtr hashArena(newArena(Options("").resetting(true).threading(false).pagesize(8 * 1024 * 1204).parent(operatorArena)));
-        JoinHashTable table(settings, hashArena, WHICH_REPLICATED == LEFT ? settings.getLeftTupleSize() : settings.getRightTupleSize());
+        ArenaPtr hashArena(newArena(Options("").resetting(true).threading(true).pagesize(8 * 1024 * 1204).parent(operatorArena)));
+        JoinHashTable<LAYOUT> table(settings, hashArena, WHICH_REPLICATED == LEFT ? settings.getLeftTupleSize() : settings.getRightTupleSize(), tableSizeHint);
         shared_ptr<ChunkFilter<WHICH_REPLICATED> >filter;
-        if ((WHICH_REPLICATED == LEFT && !settings.isRightOuter()) || (WHICH_REPLICATED == RIGHT && !settings.isLeftOuter()))
+        if ((WHICH_REPLICATED == LEFT && !settings.isRightOuter()) || (WHICH_REPLICATED == RIGHT && (!settings.needsLeftMisses() || settings.isSemiJoin())))
         {
             filter.reset(new ChunkFilter<WHICH_REPLICATED>(settings, inputArrays[0]->getArrayDesc(), inputArrays[1]->getArrayDesc()));
         }
-        readIntoHashTable<WHICH_REPLICATED, READ_INPUT> (redistributed, table, settings, filter.get());
-        if(settings.isLeftOuter() || settings.isRightOuter())
+        bool withinLimit = buildReplicatedTable<WHICH_REPLICATED>(input, table, query, settings, filter.get());
+        if(!agreeOnBoolean(withinLimit, query))
         {
-            return arrayToTableJoin<WHICH_REPLICATED, READ_INPUT, true>( WHICH_REPLICATED == LEFT ? inputArrays[1]: inputArrays[0], table, query, settings, filter.get());
+            LOG4CXX_DEBUG(logger, "EJ replicated table over memory limit on some instance, abandoning it");
+            return shared_ptr<Array>();
         }
-        return arrayToTableJoin<WHICH_REPLICATED, READ_INPUT, false>( WHICH_REPLICATED == LEFT ? inputArrays[1]: inputArrays[0], table, query, settings, filter.get());
+        return probeReplicatedTable<WHICH_REPLICATED>(inputArrays, table, query, settings, filter.get());
     }
 
+    /**
+     * The replicationHashJoin path for a stored array. Every instance looks the table up in its own TableCache, and
+     * the cached copies are only used if all instances have one; otherwise the table is built again, with its chunk
+     * filter always trained so that it can serve inner and outer joins alike, and offered to the cache.
+     */
+    template <Handedness WHICH_REPLICATED, KeyLayout LAYOUT>
+    shared_ptr<Array> cachedReplicationHashJoin(vector< shared_ptr< Array> >& inputArrays, shared_ptr<Query>& query, Settings const& settings,
+                                                size_t const tableSizeHint, ArrayID const uaid, VersionID const version)
+    {
+        TableCache& cache = TableCache::getInstance();
+        string const key = getTableCacheKey<WHICH_REPLICATED, LAYOUT>(query, settings);
+        shared_ptr<CachedTable<WHICH_REPLICATED, LAYOUT> > cached = dynamic_pointer_cast<CachedTable<WHICH_REPLICATED, LAYOUT> >(cache.get(uaid, version, key));
+        if(agreeOnBoolean(cached.get() != NULL, query))
+        {
+            LOG4CXX_DEBUG(logger, "EJ using cached table for array "<<uaid<<" version "<<version);
+            ChunkFilter<WHICH_REPLICATED> filter(cached->getFilter()); //a copy: the filter has scratch buffers, other queries may be probing
+            return probeReplicatedTable<WHICH_REPLICATED>(inputArrays, cached->getTable(), query, settings, &filter);
+        }
+        shared_ptr<Array>& input = (WHICH_REPLICATED == LEFT ? inputArrays[0] : inputArrays[1]);
+        cached.reset(new CachedTable<WHICH_REPLICATED, LAYOUT>(settings, tableSizeHint));
+        bool withinLimit = buildReplicatedTable<WHICH_REPLICATED>(input, cached->getTable(), query, settings, &(cached->getFilter()));
+        if(!agreeOnBoolean(withinLimit, query))
+        {
+            LOG4CXX_DEBUG(logger, "EJ replicated table over memory limit on some instance, abandoning it");
+            return shared_ptr<Array>();
+        }
+        cache.put(uaid, version, key, cached, settings.getTableCacheSize());
+        return probeReplicatedTable<WHICH_REPLICATED>(inputArrays, cached->getTable(), query, settings, &(cached->getFilter()));
+    }
+
+    /**
+     * Read an input array into a tupled array, adding each tuple's hash. Tuples whose hash is not in bloomFilterToApply,
+     * if given, are dropped.
+     */
     template <Handedness WHICH, bool INCLUDE_NULL_TUPLES = false, bool HASH_NULLS = false>
     shared_ptr<Array> readIntoPreSort(shared_ptr<Array> & inputArray, shared_ptr<Query>& query, Settings const& settings,
                                       ChunkFilter<WHICH>* chunkFilterToGenerate, ChunkFilter<WHICH == LEFT ? RIGHT : LEFT> const* chunkFilterToApply,
-                                      BloomFilter* bloomFilterToGenerate,        BloomFilter const* bloomFilterToApply)
+                                      BloomFilter const* bloomFilterToApply = NULL)
     {
-        ArrayReader<WHICH, READ_INPUT, INCLUDE_NULL_TUPLES> reader(inputArray, settings, chunkFilterToApply, bloomFilterToApply);
+        ArrayReader<WHICH, READ_INPUT, INCLUDE_NULL_TUPLES> reader(inputArray, settings, chunkFilterToApply);
         ArrayWriter<WRITE_TUPLED> writer(settings, query, makeTupledSchema<WHICH>(settings, query));
-        size_t const hashMod = settings.getNumHashBuckets();
         vector<char> hashBuf(64);
         size_t const numKeys = settings.getNumKeys();
+        size_t const keySize = settings.getKeySize(); //0 unless all keys have a fixed size
         Value hashVal;
+        size_t excludedBloom = 0;
+        KeyDictionary const* dictionary = settings.getKeyDictionary();
+        vector<Value> codes(numKeys);
+        vector<Value const*> encoded;
         while(!reader.end())
         {
             vector<Value const*> const& tuple = reader.getTuple();
@@ -424,15 +1167,33 @@ public:
             {
                 chunkFilterToGenerate->addTuple(tuple);
             }
-            if(bloomFilterToGenerate)
+            if(dictionary)
             {
-                bloomFilterToGenerate->addTuple(tuple, numKeys);
+                encoded.assign(tuple.begin(), tuple.end());
+                for(size_t i =0; i<numKeys; ++i)
+                {
+                    if(settings.isKeyEncoded(i))
+                    {
+                        dictionary->encode(*(tuple[i]), codes[i]);
+                        encoded[i] = &(codes[i]);
+                    }
+                }
             }
-            hashVal.setUint32( JoinHashTable::hashKeys<HASH_NULLS>(tuple, numKeys, hashBuf) % hashMod);
-            writer.writeTupleWithHash(tuple, hashVal);
+            vector<Value const*> const& output = dictionary ? encoded : tuple;
+            uint64_t const hash = keySize != 0 ? JoinHashTable<>::hashFixedKeys64<HASH_NULLS>(output, numKeys, keySize, hashBuf) :
+                                                 JoinHashTable<>::hashKeys64<HASH_NULLS>(output, numKeys, hashBuf); //full hash: sorted on first, compared before any keys
+            if(bloomFilterToApply && !bloomFilterToApply->hasHash(hash))
+            {
+                ++excludedBloom;
+                reader.next();
+                continue;
+            }
+            hashVal.setUint64(hash);
+            writer.writeTupleWithHash(output, hashVal);
             reader.next();
         }
         reader.logStats();
+        LOG4CXX_DEBUG(logger, "EJ Bloom filter tuples excluded "<<excludedBloom);
         return writer.finalize();
     }
 
@@ -470,13 +1231,13 @@ public:
     shared_ptr<Array> localSortedMergeJoin(shared_ptr<Array>& leftSorted, shared_ptr<Array>& rightSorted, shared_ptr<Query>& query, Settings const& settings)
     {
         ArrayWriter<WRITE_OUTPUT> output(settings, query, _schema);
-        vector<AttributeComparator> const& comparators = settings.getKeyComparators();
+        vector<AttributeComparator> const& comparators = settings.getTupledKeyComparators();
         size_t const numKeys = settings.getNumKeys();
         ArrayReader<LEFT, READ_SORTED>  leftReader (leftSorted,  settings);
         ArrayReader<RIGHT, READ_SORTED> rightReader(rightSorted, settings);
         vector<Value> previousLeftKeys(numKeys);
         Coordinate previousRightIdx = -1;
-        uint32_t previousLeftHash;
+        uint64_t previousLeftHash;
         size_t const leftTupleSize = settings.getLeftTupleSize();
         size_t const rightTupleSize = settings.getRightTupleSize();
         while(!leftReader.end() && !rightReader.end())
@@ -495,8 +1256,8 @@ public:
                 rightReader.next();
                 continue;
             }
-            uint32_t leftHash = ((*leftTuple)[leftTupleSize])->getUint32();
-            uint32_t rightHash =((*rightTuple)[rightTupleSize])->getUint32();
+            uint64_t leftHash = ((*leftTuple)[leftTupleSize])->getUint64();
+            uint64_t rightHash =((*rightTuple)[rightTupleSize])->getUint64();
             if(leftHash < rightHash)
             {
                 if(LEFT_OUTER)
@@ -515,7 +1276,8 @@ public:
                 rightReader.next();
                 continue;
             }
-            else if(JoinHashTable::keysLess(*leftTuple, *rightTuple, comparators, numKeys))
+            //the hash column holds the full 64-bit hash of the keys, so from here on the keys are most likely equal
+            else if(JoinHashTable<>::keysLess(*leftTuple, *rightTuple, comparators, numKeys))
             {
                 if(LEFT_OUTER)
                 {
@@ -524,7 +1286,7 @@ public:
                 leftReader.next();
                 continue;
             }
-            else if(JoinHashTable::keysLess(*rightTuple, *leftTuple, comparators, numKeys))
+            else if(JoinHashTable<>::keysLess(*rightTuple, *leftTuple, comparators, numKeys))
             {
                 if(RIGHT_OUTER)
                 {
@@ -535,8 +1297,9 @@ public:
             }
             //JOIN TIME!
             bool first = true;
-            while(!rightReader.end() && rightHash == leftHash && JoinHashTable::keysEqual(*leftTuple, *rightTuple, numKeys))
+            while(!rightReader.end() && rightHash == leftHash && JoinHashTable<>::keysEqual(*leftTuple, *rightTuple, numKeys))
             {
+                bool const firstMatch = first;
                 if(first)
                 {
                     for(size_t i=0; i<numKeys; ++i)
@@ -546,12 +1309,15 @@ public:
                     previousRightIdx = rightReader.getIdx(); //remember where the rightReader was in case we need to rewind later
                     first = false;
                 }
-                output.writeTuple(*leftTuple, *rightTuple);
+                if(firstMatch || !settings.isSemiOrAntiJoin()) //semi and anti joins only output a left tuple once
+                {
+                    output.writeTuple(*leftTuple, *rightTuple);
+                }
                 rightReader.next();
                 if(!rightReader.end())
                 {
                     rightTuple = &(rightReader.getTuple());
-                    rightHash =((*rightTuple)[rightTupleSize])->getUint32();
+                    rightHash =((*rightTuple)[rightTupleSize])->getUint64();
                     if(RIGHT_OUTER && isNullTuple(*rightTuple, numKeys))
                     {
                         break; //will be caught up top
@@ -562,8 +1328,8 @@ public:
             if(!leftReader.end())  //if the keys in the left reader are repeated, rewind the right reader to where it was
             {
                 leftTuple = &(leftReader.getTuple());
-                uint32_t nextLeftHash = ((*leftTuple)[leftTupleSize])->getUint32();
-                if(leftHash == nextLeftHash && (!LEFT_OUTER || !isNullTuple(*leftTuple, numKeys)) && JoinHashTable::keysEqual( &(previousLeftKeys[0]), *leftTuple, numKeys) && !first)
+                uint64_t nextLeftHash = ((*leftTuple)[leftTupleSize])->getUint64();
+                if(leftHash == nextLeftHash && (!LEFT_OUTER || !isNullTuple(*leftTuple, numKeys)) && JoinHashTable<>::keysEqual( &(previousLeftKeys[0]), *leftTuple, numKeys) && !first)
                 {
                     rightReader.setIdx(previousRightIdx);
                     rightTuple = &rightReader.getTuple();
@@ -583,121 +1349,272 @@ public:
         return output.finalize();
     }
 
-    template <Handedness WHICH_FIRST, bool LEFT_OUTER, bool RIGHT_OUTER>
-    shared_ptr<Array> globalMergeJoin(vector< shared_ptr< Array> >& inputArrays, shared_ptr<Query> query, Settings const& settings)
+    /**
+     * Add the hash of every tuple of a tupled array to filter.
+     */
+    void addHashesToFilter(shared_ptr<Array>& tupled, BloomFilter& filter)
+    {
+        size_t const hashAttr = tupled->getArrayDesc().getAttributes(true).size() - 1;
+        size_t i = 0;
+        for(const auto& attr : tupled->getArrayDesc().getAttributes(true))
+        {
+            if(i++ != hashAttr)
+            {
+                continue;
+            }
+            shared_ptr<ConstArrayIterator> aiter = tupled->getConstIterator(attr);
+            while(!aiter->end())
+            {
+                shared_ptr<ConstChunkIterator> citer = aiter->getChunk().getConstIterator();
+                while(!citer->end())
+                {
+                    filter.addHash(citer->getItem().getUint64());
+                    ++(*citer);
+                }
+                ++(*aiter);
+            }
+        }
+    }
+
+    /**
+     * @param firstCellCount the number of cells of the first array over all instances, if pickAlgorithm counted them;
+     *        0 otherwise, in which case they are only counted here for a materialized array
+     */
+    template <Handedness WHICH_FIRST, bool LEFT_OUTER, bool RIGHT_OUTER, KeyLayout LAYOUT>
+    shared_ptr<Array> globalMergeJoin(vector< shared_ptr< Array> >& inputArrays, shared_ptr<Query> query, Settings const& settings,
+                                      size_t const firstCellCount, bool const radixPartition = false)
     {
         shared_ptr<Array>& first = (WHICH_FIRST == LEFT ? inputArrays[0] : inputArrays[1]);
         shared_ptr<ChunkFilter <WHICH_FIRST> > chunkFilter;
         shared_ptr<BloomFilter> bloomFilter;
         if ((WHICH_FIRST == LEFT && !RIGHT_OUTER) || (WHICH_FIRST == RIGHT && !LEFT_OUTER)) //if second array is not outer, then use first array to filter it!
         {
-            chunkFilter.reset(new ChunkFilter<WHICH_FIRST>(settings, inputArrays[0]->getArrayDesc(), inputArrays[1]->getArrayDesc()));
-            bloomFilter.reset(new BloomFilter(settings.getBloomFilterSize()));
+            size_t cellCount = firstCellCount; //0 if not known
+            if(cellCount == 0 && agreeOnBoolean(first->isMaterialized(), query)) //counting anything else would evaluate it again
+            {
+                globalComputeArrayOverhead<WHICH_FIRST>(first, query, settings, &cellCount);
+            }
+            chunkFilter.reset(new ChunkFilter<WHICH_FIRST>(settings, inputArrays[0]->getArrayDesc(), inputArrays[1]->getArrayDesc(), cellCount));
+            bloomFilter.reset(new BloomFilter(settings, cellCount, query->getInstancesCount()));
+            LOG4CXX_DEBUG(logger, "EJ merge filters for cells "<<cellCount<<" bloom filter bits "<<bloomFilter->getBitSize()
+                                  <<" hashes "<<bloomFilter->getNumHashes());
         }
         bool const KEEP_FIRST_NULL_TUPLES = ((WHICH_FIRST == LEFT && LEFT_OUTER) || (WHICH_FIRST == RIGHT && RIGHT_OUTER));
         bool const HASH_NULLS = (LEFT_OUTER || RIGHT_OUTER); //hashes gotta match
-        first = readIntoPreSort<WHICH_FIRST, KEEP_FIRST_NULL_TUPLES, HASH_NULLS>(first, query, settings, chunkFilter.get(), NULL, bloomFilter.get(), NULL);
+        first = readIntoPreSort<WHICH_FIRST, KEEP_FIRST_NULL_TUPLES, HASH_NULLS>(first, query, settings, chunkFilter.get(), NULL);
         first = sortArray(first, query, settings);
         first = sortedToPreSg<WHICH_FIRST>(first, query, settings);
         first = redistributeToRandomAccess(first,createDistribution(dtByRow),query->getDefaultArrayResidency(), query, shared_from_this());
         if(chunkFilter.get())
         {
             chunkFilter->globalExchange(query);
+            addHashesToFilter(first, *bloomFilter); //after redistribution, so each instance only fills its own partition
             bloomFilter->globalExchange(query);
         }
         Handedness const WHICH_SECOND = (WHICH_FIRST == LEFT ? RIGHT : LEFT);
         bool const KEEP_SECOND_NULL_TUPLES = ((WHICH_SECOND == LEFT && LEFT_OUTER) || (WHICH_SECOND == RIGHT && RIGHT_OUTER));
         shared_ptr<Array>& second = (WHICH_SECOND == LEFT ? inputArrays[0] : inputArrays[1]);
-        second = readIntoPreSort<WHICH_SECOND, KEEP_SECOND_NULL_TUPLES, HASH_NULLS>(second, query, settings, NULL, chunkFilter.get(), NULL, bloomFilter.get());
+        second = readIntoPreSort<WHICH_SECOND, KEEP_SECOND_NULL_TUPLES, HASH_NULLS>(second, query, settings, NULL, chunkFilter.get(), bloomFilter.get());
         second = sortArray(second, query, settings);
         second = sortedToPreSg<WHICH_SECOND>(second, query, settings);
         second = redistributeToRandomAccess(second,createDistribution(dtByRow),query->getDefaultArrayResidency(), query, shared_from_this());
 
-        size_t const firstOverhead  = computeArrayOverhead<WHICH_FIRST>(first, query, settings);
-        size_t const secondOverhead = computeArrayOverhead<WHICH_SECOND>(second, query, settings);
+        size_t firstCount = 0, secondCount = 0;
+        size_t const firstOverhead  = computeArrayOverhead<WHICH_FIRST>(first, query, settings, &firstCount);
+        size_t const secondOverhead = computeArrayOverhead<WHICH_SECOND>(second, query, settings, &secondCount);
         LOG4CXX_DEBUG(logger, "EJ merge after SG first overhead "<<firstOverhead<<" second overhead "<<secondOverhead);
+        //radix_partition_* keeps the first array in the table, unless it was picked for us and turned out too big here
+        if (radixPartition && (settings.algorithmSet() || firstOverhead < settings.getHashJoinThreshold()))
+        {
+            LOG4CXX_DEBUG(logger, "EJ merge radix partitioning first");
+            return radixHashJoin<WHICH_FIRST, LEFT_OUTER || RIGHT_OUTER, LAYOUT>( first, second, query, settings, firstOverhead, firstCount);
+        }
         //if one of the arrays is small enough, and it's not being outer-joined, we can read it into table! Note: this is a local decision
         if (firstOverhead < settings.getHashJoinThreshold() && ((WHICH_FIRST == LEFT && !LEFT_OUTER) || (WHICH_FIRST == RIGHT && !RIGHT_OUTER)))
         {
+            if(firstOverhead >= RADIX_MIN_TABLE_SIZE)
+            {
+                LOG4CXX_DEBUG(logger, "EJ merge radix partitioning first");
+                return radixHashJoin<WHICH_FIRST, LEFT_OUTER || RIGHT_OUTER, LAYOUT>( first, second, query, settings, firstOverhead, firstCount);
+            }
             LOG4CXX_DEBUG(logger, "EJ merge rehashing first");
             ArenaPtr operatorArena = this->getArena();
-            ArenaPtr hashArena(newArena(Options("").resetting(true).threading(false).pagesize(8 * 1024 * 1204).parent(operatorArena)));
-            JoinHashTable table(settings, hashArena, WHICH_FIRST == LEFT ? settings.getLeftTupleSize() : settings.getRightTupleSize());
-            readIntoHashTable<WHICH_FIRST, READ_TUPLED> (first, table, settings);
-            return arrayToTableJoin<WHICH_FIRST, READ_TUPLED, LEFT_OUTER || RIGHT_OUTER>( second, table, query, settings);
+            ArenaPtr hashArena(newArena(Options("").resetting(true).threading(true).pagesize(8 * 1024 * 1204).parent(operatorArena)));
+            JoinHashTable<LAYOUT> table(settings, hashArena, WHICH_FIRST == LEFT ? settings.getLeftTupleSize() : settings.getRightTupleSize(), firstCount);
+            if(readIntoHashTable<WHICH_FIRST, READ_TUPLED> (first, table, settings, NULL, settings.getMemoryLimit()))
+            {
+                return arrayToTableJoin<WHICH_FIRST, READ_TUPLED, LEFT_OUTER || RIGHT_OUTER>( second, table, query, settings);
+            }
+            LOG4CXX_DEBUG(logger, "EJ merge table of first over memory limit, sorting instead");
         }
         else if(secondOverhead < settings.getHashJoinThreshold() && ((WHICH_FIRST == RIGHT && !LEFT_OUTER) || (WHICH_FIRST == LEFT && !RIGHT_OUTER)))
         {
+            if(secondOverhead >= RADIX_MIN_TABLE_SIZE)
+            {
+                LOG4CXX_DEBUG(logger, "EJ merge radix partitioning second");
+                return radixHashJoin<WHICH_SECOND, LEFT_OUTER || RIGHT_OUTER, LAYOUT>( second, first, query, settings, secondOverhead, secondCount);
+            }
             LOG4CXX_DEBUG(logger, "EJ merge rehashing second");
             ArenaPtr operatorArena = this->getArena();
-            ArenaPtr hashArena(newArena(Options("").resetting(true).threading(false).pagesize(8 * 1024 * 1204).parent(operatorArena)));
-            JoinHashTable table(settings, hashArena, WHICH_FIRST == LEFT ? settings.getRightTupleSize() : settings.getLeftTupleSize());
-            readIntoHashTable<WHICH_SECOND, READ_TUPLED> (second, table, settings);
-            return arrayToTableJoin<WHICH_SECOND, READ_TUPLED, LEFT_OUTER || RIGHT_OUTER>( first, table, query, settings);
+            ArenaPtr hashArena(newArena(Options("").resetting(true).threading(true).pagesize(8 * 1024 * 1204).parent(operatorArena)));
+            JoinHashTable<LAYOUT> table(settings, hashArena, WHICH_FIRST == LEFT ? settings.getRightTupleSize() : settings.getLeftTupleSize(), secondCount);
+            if(readIntoHashTable<WHICH_SECOND, READ_TUPLED> (second, table, settings, NULL, settings.getMemoryLimit()))
+            {
+                return arrayToTableJoin<WHICH_SECOND, READ_TUPLED, LEFT_OUTER || RIGHT_OUTER>( first, table, query, settings);
+            }
+            LOG4CXX_DEBUG(logger, "EJ merge table of second over memory limit, sorting instead");
         }
-        else
+        //neither fits: hash join anyway, spilling whatever partitions of the table do not fit, unless both sides are outer
+        else if(settings.useHybridHash() && ((WHICH_FIRST == LEFT && !LEFT_OUTER) || (WHICH_FIRST == RIGHT && !RIGHT_OUTER)) &&
+                (firstOverhead <= secondOverhead || (WHICH_FIRST == RIGHT && LEFT_OUTER) || (WHICH_FIRST == LEFT && RIGHT_OUTER)))
+        {
+            LOG4CXX_DEBUG(logger, "EJ merge hybrid hashing first");
+            return hybridHashJoin<WHICH_FIRST, LEFT_OUTER || RIGHT_OUTER, LAYOUT>( first, second, query, settings, firstOverhead, firstCount);
+        }
+        else if(settings.useHybridHash() && ((WHICH_FIRST == RIGHT && !LEFT_OUTER) || (WHICH_FIRST == LEFT && !RIGHT_OUTER)))
         {
-            //Sort em both, sort em out
-            LOG4CXX_DEBUG(logger, "EJ merge sorted");
-            first = sortArray(first, query, settings);
-            second= sortArray(second, query, settings);
-            return WHICH_FIRST == LEFT ? localSortedMergeJoin<LEFT_OUTER, RIGHT_OUTER>(first, second, query, settings) :
-                                         localSortedMergeJoin<LEFT_OUTER, RIGHT_OUTER>(second, first, query, settings);
+            LOG4CXX_DEBUG(logger, "EJ merge hybrid hashing second");
+            return hybridHashJoin<WHICH_SECOND, LEFT_OUTER || RIGHT_OUTER, LAYOUT>( second, first, query, settings, secondOverhead, secondCount);
         }
+        //Sort em both, sort em out
+        LOG4CXX_DEBUG(logger, "EJ merge sorted");
+        first = sortArray(first, query, settings);
+        second= sortArray(second, query, settings);
+        return WHICH_FIRST == LEFT ? localSortedMergeJoin<LEFT_OUTER, RIGHT_OUTER>(first, second, query, settings) :
+                                     localSortedMergeJoin<LEFT_OUTER, RIGHT_OUTER>(second, first, query, settings);
     }
 
-    shared_ptr< Array> execute(vector< shared_ptr< Array> >& inputArrays, shared_ptr<Query> query) override
+    /**
+     * Collect the string keys of both arrays into a dictionary shared by all instances. The arrays are read once more
+     * by the join afterwards, so single-pass inputs are materialized first.
+     * @return the dictionary, or null if the keys do not repeat enough for it to pay off
+     */
+    shared_ptr<KeyDictionary const> buildKeyDictionary(vector< shared_ptr< Array> >& inputArrays, shared_ptr<Query>& query, Settings const& settings)
+    {
+        for(size_t i =0; i<2; ++i)
+        {
+            if(inputArrays[i]->getSupportedAccess() == Array::SINGLE_PASS)
+            {
+                LOG4CXX_DEBUG(logger, "EJ ensuring random access before dictionary");
+                inputArrays[i] = ensureRandomAccess(inputArrays[i], query);
+            }
+        }
+        shared_ptr<KeyDictionary> dictionary(new KeyDictionary());
+        dictionary->addArray<LEFT>(inputArrays[0], settings);
+        dictionary->addArray<RIGHT>(inputArrays[1], settings);
+        if(!dictionary->globalExchange(query, settings))
+        {
+            return shared_ptr<KeyDictionary const>();
+        }
+        return dictionary;
+    }
+
+    /**
+     * Run the chosen algorithm; any hash tables it builds are specialized for LAYOUT.
+     */
+    template <KeyLayout LAYOUT>
+    shared_ptr<Array> runAlgorithm(Settings::algorithm algo, vector< shared_ptr< Array> >& inputArrays, shared_ptr<Query>& query,
+                                   Settings const& settings, vector<size_t> const& cellCounts)
     {
-        vector<ArrayDesc const*> inputSchemas(2);
-        inputSchemas[0] = &inputArrays[0]->getArrayDesc();
-        inputSchemas[1] = &inputArrays[1]->getArrayDesc();
-        LOG4CXX_DEBUG(logger, "execute - Checking attributes.");
-        Settings settings(inputSchemas, _parameters, _kwParameters, query);
-        Settings::algorithm algo = pickAlgorithm(inputArrays, query, settings);
         if(algo == Settings::HASH_REPLICATE_LEFT)
         {
             LOG4CXX_DEBUG(logger, "EJ running hash_replicate_left");
-            return replicationHashJoin<LEFT>(inputArrays, query, settings);
+            shared_ptr<Array> result = replicationHashJoin<LEFT, LAYOUT>(inputArrays, query, settings, cellCounts[0]);
+            if(result)
+            {
+                return result;
+            }
+            LOG4CXX_DEBUG(logger, "EJ falling back to merge_left_first");
+            return runAlgorithm<LAYOUT>(Settings::MERGE_LEFT_FIRST, inputArrays, query, settings, cellCounts);
         }
         else if (algo == Settings::HASH_REPLICATE_RIGHT)
         {
             LOG4CXX_DEBUG(logger, "EJ running hash_replicate_right");
-            return replicationHashJoin<RIGHT>(inputArrays, query, settings);
+            shared_ptr<Array> result = replicationHashJoin<RIGHT, LAYOUT>(inputArrays, query, settings, cellCounts[1]);
+            if(result)
+            {
+                return result;
+            }
+            LOG4CXX_DEBUG(logger, "EJ falling back to merge_right_first");
+            return runAlgorithm<LAYOUT>(Settings::MERGE_RIGHT_FIRST, inputArrays, query, settings, cellCounts);
+        }
+        else if (algo == Settings::RADIX_PARTITION_LEFT)
+        {
+            LOG4CXX_DEBUG(logger, "EJ running radix_partition_left");
+            if(settings.isRightOuter())
+            {
+                return globalMergeJoin<LEFT, false, true, LAYOUT>(inputArrays, query, settings, cellCounts[0], true);
+            }
+            return globalMergeJoin<LEFT, false, false, LAYOUT>(inputArrays, query, settings, cellCounts[0], true);
+        }
+        else if (algo == Settings::RADIX_PARTITION_RIGHT)
+        {
+            LOG4CXX_DEBUG(logger, "EJ running radix_partition_right");
+            if(settings.needsLeftMisses())
+            {
+                return globalMergeJoin<RIGHT, true, false, LAYOUT>(inputArrays, query, settings, cellCounts[1], true);
+            }
+            return globalMergeJoin<RIGHT, false, false, LAYOUT>(inputArrays, query, settings, cellCounts[1], true);
         }
         else if (algo == Settings::MERGE_LEFT_FIRST)
         {
             LOG4CXX_DEBUG(logger, "EJ running merge_left_first");
-            if(settings.isLeftOuter() && settings.isRightOuter())
+            if(settings.needsLeftMisses() && settings.isRightOuter())
             {
-                return globalMergeJoin<LEFT, true, true>(inputArrays, query, settings);
+                return globalMergeJoin<LEFT, true, true, LAYOUT>(inputArrays, query, settings, cellCounts[0]);
             }
-            if(settings.isLeftOuter())
+            if(settings.needsLeftMisses())
             {
-                return globalMergeJoin<LEFT, true, false>(inputArrays, query, settings);
+                return globalMergeJoin<LEFT, true, false, LAYOUT>(inputArrays, query, settings, cellCounts[0]);
             }
             if(settings.isRightOuter())
             {
-                return globalMergeJoin<LEFT, false, true>(inputArrays, query, settings);
+                return globalMergeJoin<LEFT, false, true, LAYOUT>(inputArrays, query, settings, cellCounts[0]);
             }
-            return globalMergeJoin<LEFT, false, false>(inputArrays, query, settings);
+            return globalMergeJoin<LEFT, false, false, LAYOUT>(inputArrays, query, settings, cellCounts[0]);
         }
         else
         {
             LOG4CXX_DEBUG(logger, "EJ running merge_right_first");
-            if(settings.isLeftOuter() && settings.isRightOuter())
+            if(settings.needsLeftMisses() && settings.isRightOuter())
             {
-                return globalMergeJoin<RIGHT, true, true>(inputArrays, query, settings);
+                return globalMergeJoin<RIGHT, true, true, LAYOUT>(inputArrays, query, settings, cellCounts[1]);
             }
-            if(settings.isLeftOuter())
+            if(settings.needsLeftMisses())
             {
-                return globalMergeJoin<RIGHT, true, false>(inputArrays, query, settings);
+                return globalMergeJoin<RIGHT, true, false, LAYOUT>(inputArrays, query, settings, cellCounts[1]);
             }
             if(settings.isRightOuter())
             {
-                return globalMergeJoin<RIGHT, false, true>(inputArrays, query, settings);
+                return globalMergeJoin<RIGHT, false, true, LAYOUT>(inputArrays, query, settings, cellCounts[1]);
             }
-            return globalMergeJoin<RIGHT, false, false>(inputArrays, query, settings);
+            return globalMergeJoin<RIGHT, false, false, LAYOUT>(inputArrays, query, settings, cellCounts[1]);
+        }
+    }
+
+    shared_ptr< Array> execute(vector< shared_ptr< Array> >& inputArrays, shared_ptr<Query> query) override
+    {
+        vector<ArrayDesc const*> inputSchemas(2);
+        inputSchemas[0] = &inputArrays[0]->getArrayDesc();
+        inputSchemas[1] = &inputArrays[1]->getArrayDesc();
+        LOG4CXX_DEBUG(logger, "execute - Checking attributes.");
+        Settings settings(inputSchemas, _parameters, _kwParameters, query);
+        vector<size_t> cellCounts;
+        Settings::algorithm algo = pickAlgorithm(inputArrays, query, settings, cellCounts);
+        if(settings.useDictionaryKeys() && settings.hasStringKeys() &&
+           algo != Settings::HASH_REPLICATE_LEFT && algo != Settings::HASH_REPLICATE_RIGHT)
+        {
+            settings.setKeyDictionary(buildKeyDictionary(inputArrays, query, settings));
+        }
+        if(settings.getKeyLayout() == KEYS_PACKED_64)
+        {
+            return runAlgorithm<KEYS_PACKED_64>(algo, inputArrays, query, settings, cellCounts);
+        }
+        else if(settings.getKeyLayout() == KEYS_PACKED_128)
+        {
+            return runAlgorithm<KEYS_PACKED_128>(algo, inputArrays, query, settings, cellCounts);
         }
+        return runAlgorithm<KEYS_GENERIC>(algo, inputArrays, query, settings, cellCounts);
     }
 };
 
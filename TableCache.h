@@ -0,0 +1,191 @@
+/*
+**
+* BEGIN_COPYRIGHT
+*
+* Copyright (C) 2008-2016 SciDB, Inc.
+* All Rights Reserved.
+*
+* equi_join is a plugin for SciDB, an Open Source Array DBMS maintained
+* by Paradigm4. See http://www.paradigm4.com/
+*
+* equi_join is free software: you can redistribute it and/or modify
+* it under the terms of the AFFERO GNU General Public License as published by
+* the Free Software Foundation.
+*
+* equi_join is distributed "AS-IS" AND WITHOUT ANY WARRANTY OF ANY KIND,
+* INCLUDING ANY IMPLIED WARRANTY OF MERCHANTABILITY,
+* NON-INFRINGEMENT, OR FITNESS FOR A PARTICULAR PURPOSE. See
+* the AFFERO GNU General Public License for the complete license terms.
+*
+* You should have received a copy of the AFFERO GNU General Public License
+* along with equi_join.  If not, see <http://www.gnu.org/licenses/agpl-3.0.html>
+*
+* END_COPYRIGHT
+*/
+
+#ifndef TABLE_CACHE_H
+#define TABLE_CACHE_H
+
+#include <list>
+#include <mutex>
+
+#include "EquiJoinSettings.h"
+#include "JoinHashTable.h"
+#include "ArrayIO.h"
+
+namespace scidb
+{
+namespace equi_join
+{
+
+class CachedTableBase
+{
+public:
+    virtual ~CachedTableBase()
+    {}
+
+    virtual size_t usedBytes() const = 0;
+};
+
+/**
+ * A replicated hash table and the chunk filter trained with it, kept past the end of the query that built them. It
+ * owns a copy of the settings the table refers to and an arena of its own, outside of any query.
+ */
+template <Handedness WHICH, KeyLayout LAYOUT>
+class CachedTable : public CachedTableBase
+{
+private:
+    Settings const          _settings;
+    ArenaPtr                _arena;
+    JoinHashTable<LAYOUT>   _table;
+    ChunkFilter<WHICH>      _filter;
+
+public:
+    CachedTable(Settings const& settings, size_t const tableSizeHint):
+        _settings(settings),
+        _arena(newArena(Options("").resetting(true).threading(true).pagesize(8 * 1024 * 1024))),
+        _table(_settings, _arena, WHICH == LEFT ? _settings.getLeftTupleSize() : _settings.getRightTupleSize(), tableSizeHint),
+        _filter(_settings, _settings.getLeftSchema(), _settings.getRightSchema())
+    {}
+
+    JoinHashTable<LAYOUT>& getTable()
+    {
+        return _table;
+    }
+
+    ChunkFilter<WHICH>& getFilter()
+    {
+        return _filter;
+    }
+
+    size_t usedBytes() const override
+    {
+        return _table.usedBytes() + _filter.usedBytes();
+    }
+};
+
+/**
+ * An instance-local LRU cache of replicated hash tables built from stored arrays, shared by all queries. Entries are
+ * keyed by the array UAID and version plus a description of the join that built them; a lookup for a newer version
+ * of an array drops the entries of the older ones. Tables are handed out as shared pointers, so an entry evicted
+ * while a query is still probing it is only freed when that query is done.
+ */
+class TableCache
+{
+private:
+    struct Entry
+    {
+        ArrayID                      uaid;
+        VersionID                    version;
+        string                       key;
+        shared_ptr<CachedTableBase>  table;
+        size_t                       bytes;
+    };
+
+    std::mutex       _mutex;
+    std::list<Entry> _entries;   //most recently used first
+    size_t           _usedBytes;
+
+    TableCache():
+        _usedBytes(0)
+    {}
+
+    void invalidate(ArrayID const uaid, VersionID const version)
+    {
+        for(std::list<Entry>::iterator iter = _entries.begin(); iter != _entries.end(); )
+        {
+            if(iter->uaid == uaid && iter->version < version)
+            {
+                LOG4CXX_DEBUG(logger, "EJ table cache dropping array "<<uaid<<" version "<<iter->version);
+                _usedBytes -= iter->bytes;
+                iter = _entries.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+    }
+
+public:
+    static TableCache& getInstance()
+    {
+        static TableCache instance;
+        return instance;
+    }
+
+    /**
+     * @return the table cached for version of the array and key, or NULL
+     */
+    shared_ptr<CachedTableBase> get(ArrayID const uaid, VersionID const version, string const& key)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        invalidate(uaid, version);
+        for(std::list<Entry>::iterator iter = _entries.begin(); iter != _entries.end(); ++iter)
+        {
+            if(iter->version == version && iter->key == key && iter->uaid == uaid)
+            {
+                _entries.splice(_entries.begin(), _entries, iter);
+                return _entries.front().table;
+            }
+        }
+        return shared_ptr<CachedTableBase>();
+    }
+
+    /**
+     * Add a table, then evict the least recently used ones until the cache holds no more than limit bytes. A table
+     * larger than limit by itself is not kept.
+     */
+    void put(ArrayID const uaid, VersionID const version, string const& key, shared_ptr<CachedTableBase> const& table, size_t const limit)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        invalidate(uaid, version);
+        size_t const bytes = table->usedBytes();
+        if(bytes > limit)
+        {
+            return;
+        }
+        for(std::list<Entry>::iterator iter = _entries.begin(); iter != _entries.end(); ++iter)
+        {
+            if(iter->version == version && iter->key == key && iter->uaid == uaid)
+            {
+                _usedBytes -= iter->bytes;
+                _entries.erase(iter);
+                break;
+            }
+        }
+        _entries.push_front(Entry {uaid, version, key, table, bytes});
+        _usedBytes += bytes;
+        while(_usedBytes > limit)
+        {
+            LOG4CXX_DEBUG(logger, "EJ table cache evicting array "<<_entries.back().uaid<<" version "<<_entries.back().version);
+            _usedBytes -= _entries.back().bytes;
+            _entries.pop_back();
+        }
+        LOG4CXX_DEBUG(logger, "EJ table cache holds "<<_entries.size()<<" tables, "<<_usedBytes<<" bytes");
+    }
+};
+
+} } //namespace scidb::equi_join
+
+#endif //TABLE_CACHE_H
@@ -8,8 +8,12 @@ EXPFILE=$MYDIR/test.expected
 
 iquery -anq "remove(left)"  > /dev/null 2>&1
 iquery -anq "remove(right)" > /dev/null 2>&1
+iquery -anq "remove(left_int)"   > /dev/null 2>&1
+iquery -anq "remove(right_grid)" > /dev/null 2>&1
 iquery -anq "store(apply(build(<a:string>[i=0:5,2,0], '[(null),(def),(ghi),(jkl),(mno)]', true), b, double(i)*1.1), left)" > /dev/null 2>&1
 iquery -anq "store(apply(build(<c:string>[j=1:5,3,0], '[(def),(mno),(null),(def)]', true), d, j), right)" > /dev/null 2>&1
+iquery -anq "store(apply(build(<x:int64>[i=0:3,4,0], i), y, i+100), left_int)" > /dev/null 2>&1
+iquery -anq "store(apply(filter(build(<p:int64>[m=0:99,10,0, n=0:99,10,0], m), (m=1 and n=50) or (m=50 and n=2)), q, n), right_grid)" > /dev/null 2>&1
 
 rm $OUTFILE > /dev/null 2>&1
 
@@ -408,4 +412,73 @@ iquery -aq "sort(equi_join(left, right, left_names:i , right_names:j, left_outer
 iquery -aq "sort(equi_join(left, right, left_names:i, right_names:j, left_outer:1, right_outer:1, algorithm:'merge_left_first'),  i)"  >> $OUTFILE 2>&1
 iquery -aq "sort(equi_join(left, right, left_names:i, right_names:j, left_outer:1, right_outer:1, algorithm:'merge_right_first'), i)"  >> $OUTFILE 2>&1
 
+echo " " >> $OUTFILE 2>&1
+echo "Chapter 31" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'radix_partition_left'                   ), a,b,d)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'radix_partition_right'                  ), a,b,d)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'radix_partition_right', left_outer:true ), a,b,d)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'radix_partition_left',  right_outer:true), a,b,d)" >> $OUTFILE 2>&1
+
+echo " " >> $OUTFILE 2>&1
+echo "Chapter 32" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'merge_left_first',  hash_join_threshold:0, hybrid_hash:true                   ), a,b,d)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'merge_right_first', hash_join_threshold:0                                    ), a,b,d)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'merge_left_first',  hash_join_threshold:0, hybrid_hash:true, left_outer:true  ), a,b,d)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'merge_right_first', hash_join_threshold:0, hybrid_hash:true, right_outer:true ), a,b,d)" >> $OUTFILE 2>&1
+
+echo " " >> $OUTFILE 2>&1
+echo "Chapter 33" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'hash_replicate_left',  memory_limit:0                   ), a,b,d)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'hash_replicate_right', memory_limit:1                   ), a,b,d)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'hash_replicate_left',  memory_limit:1, right_outer:true ), a,b,d)" >> $OUTFILE 2>&1
+
+echo " " >> $OUTFILE 2>&1
+echo "Chapter 34" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'merge_left_first',  hash_join_threshold:0, dictionary_keys:true                    ), a,b,d)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'merge_right_first', hash_join_threshold:0, dictionary_keys:true, hybrid_hash:true  ), a,b,d)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'merge_left_first',  hash_join_threshold:0, dictionary_keys:true, left_outer:true  ), a,b,d)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'merge_right_first', hash_join_threshold:0, dictionary_keys:true, right_outer:true ), a,b,d)" >> $OUTFILE 2>&1
+
+echo " " >> $OUTFILE 2>&1
+echo "Chapter 35" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'hash_replicate_left',  broadcast_table:true                    ), a,b,d)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'hash_replicate_right', broadcast_table:true                    ), a,b,d)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'hash_replicate_right', broadcast_table:true, left_outer:true   ), a,b,d)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'hash_replicate_left',  broadcast_table:true, right_outer:true  ), a,b,d)" >> $OUTFILE 2>&1
+
+echo " " >> $OUTFILE 2>&1
+echo "Chapter 36" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'hash_replicate_left',  cache_table:true                   ), a,b,d)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'hash_replicate_left',  cache_table:true                   ), a,b,d)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'hash_replicate_left',  cache_table:true, right_outer:true ), a,b,d)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'hash_replicate_right', cache_table:true, table_cache_size:0 ), a,b,d)" >> $OUTFILE 2>&1
+
+echo " " >> $OUTFILE 2>&1
+echo "Chapter 37" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, semi:true                                                         ), a,b)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'hash_replicate_right', semi:true                       ), a,b)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'merge_left_first',  hash_join_threshold:0, semi:true   ), a,b)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'merge_right_first', hash_join_threshold:0, semi:true, hybrid_hash:true), a,b)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, anti:true                                                         ), a,b)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'hash_replicate_right', anti:true                       ), a,b)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'merge_left_first',  hash_join_threshold:0, anti:true   ), a,b)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'merge_right_first', hash_join_threshold:0, anti:true, hybrid_hash:true), a,b)" >> $OUTFILE 2>&1
+
+echo " " >> $OUTFILE 2>&1
+echo "Chapter 38" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'merge_left_first',  hash_join_threshold:0, bloom_filter_hashes:1  ), a,b,d)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'merge_right_first', hash_join_threshold:0, bloom_filter_hashes:16 ), a,b,d)" >> $OUTFILE 2>&1
+
+echo " " >> $OUTFILE 2>&1
+echo "Chapter 39" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'merge_left_first',  hash_join_threshold:0, bloom_filter_fpr:0.5                             ), a,b,d)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left, right, left_ids:0, right_ids:0, algorithm:'merge_right_first', hash_join_threshold:0, bloom_filter_fpr:0.0001, bloom_filter_size:1000000), a,b,d)" >> $OUTFILE 2>&1
+
+echo " " >> $OUTFILE 2>&1
+echo "Chapter 40" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left_int, right_grid, left_ids:0, right_ids:-1, algorithm:'hash_replicate_left', cache_table:true), x)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left_int, right_grid, left_ids:0, right_ids:-2, algorithm:'hash_replicate_left', cache_table:true), x)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left_int, right_grid, left_ids:0, right_ids:0,  algorithm:'hash_replicate_left', cache_table:true), x)" >> $OUTFILE 2>&1
+iquery -aq "sort(equi_join(left_int, right_grid, left_ids:0, right_ids:1,  algorithm:'hash_replicate_left', cache_table:true), x)" >> $OUTFILE 2>&1
+
 diff test.out test.expected